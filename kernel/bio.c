@@ -1,10 +1,23 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Buffers hash on (dev, blockno) into NBUCKET chains, each with
+// its own lock, so lookups of different blocks do not contend.
+// A miss recycles a buffer chosen by CLOCK: the hand sweeps all
+// buffers, clearing reference bits, and takes the first unused
+// one whose bit is already clear. Misses are serialized by
+// bcache.lock, so a block is never cached twice. Buffer data
+// lives in kalloc'd pages, so NBUF is bounded only by memory.
+//
+// Read-ahead: blocks a sequential reader will want soon are read
+// into the cache by NRATHREAD kernel threads, so their disk reads
+// overlap with each other and with the reader. Requests are hints,
+// a full queue drops them.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -23,69 +36,166 @@
 #include "fs.h"
 #include "buf.h"
 
+#define NBUCKET 127  // hash chains - prime, so strided blocks spread
+#define NRA 64       // queued read-ahead requests
+#define NRATHREAD 4  // read-ahead threads
+
+struct bucket {
+  struct spinlock lock; // chain, and refcnt and used of its buffers
+  struct buf *head;
+};
+
 struct {
-  struct spinlock lock;
+  struct spinlock lock; // misses: the CLOCK hand, and moving buffers between chains
   struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  uint hand;            // next buffer CLOCK looks at
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+struct {
+  struct spinlock lock;
+  struct {
+    uint dev;
+    uint blockno;
+  } req[NRA];
+  uint r;     // next request to take - w - r are queued
+  uint w;
+} ra;
+
+static struct bucket*
+bbucket(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  uchar *page = 0;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&ra.lock, "readahead");
+  for(int i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // buffers start on no chain, so no lookup finds them
+  for(int i = 0; i < NBUF; i++){
+    b = &bcache.buf[i];
+    if(i % (PGSIZE / BSIZE) == 0 && (page = kalloc()) == 0)
+      panic("binit: kalloc");
+    b->data = page + i % (PGSIZE / BSIZE) * BSIZE;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
   }
 }
 
+// Buffer of block in chain, or 0. Chain lock must be held.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Pick a buffer to recycle, CLOCK order. bcache.lock must be held,
+// so dev and blockno of buffers do not change meanwhile.
+// Returns it off its chain, with refcnt 1.
+static struct buf*
+bvictim(void)
+{
+  // after one sweep every unused buffer has its bit clear
+  for(int n = 0; n < 2 * NBUF; n++){
+    struct buf *b = &bcache.buf[bcache.hand];
+    bcache.hand = (bcache.hand + 1) % NBUF;
+
+    struct bucket *bk = bbucket(b->dev, b->blockno);
+    acquire(&bk->lock);
+    if(b->refcnt == 0 && b->used){
+      b->used = 0;
+    } else if(b->refcnt == 0){
+      for(struct buf **pp = &bk->head; *pp; pp = &(*pp)->hnext){
+        if(*pp == b){
+          *pp = b->hnext;
+          break;
+        }
+      }
+      b->refcnt = 1;
+      release(&bk->lock);
+      return b;
+    }
+    release(&bk->lock);
+  }
+  panic("bget: no buffers");
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
 static struct buf*
 bget(uint dev, uint blockno)
 {
+  struct bucket *bk = bbucket(dev, blockno);
   struct buf *b;
 
-  acquire(&bcache.lock);
-
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    b->used = 1;
+    release(&bk->lock);
+    raidstat_bcache(0);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached. Another miss may have brought it in
+  // before we got bcache.lock, so look again.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    b->used = 1;
+    release(&bk->lock);
+    release(&bcache.lock);
+    raidstat_bcache(0);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  // Recycle a buffer: no other miss runs until it is on its new chain.
+  b = bvictim();
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->used = 1;
+  acquire(&bk->lock);
+  b->hnext = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+  raidstat_bcache(1);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Read or write b on its device: the RAID volume goes
+// through the RAID engine, anything else is disk 0.
+static void
+brw(struct buf *b, int write)
+{
+  if(b->dev == RAIDDEV){
+    uint64 r = write ? writeraid(b->blockno, b->data) : readraid(b->blockno, b->data);
+    if(r != 0)
+      panic("brw: raid");
+  } else {
+    virtio_disk_rw(VIRTIO0_ID, b, write);
   }
-  panic("bget: no buffers");
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -96,7 +206,7 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(VIRTIO0_ID, b, 0);
+    brw(b, 0);
     b->valid = 1;
   }
   return b;
@@ -108,11 +218,40 @@ bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(VIRTIO0_ID, b, 1);
+  brw(b, 1);
+}
+
+// Write n locked buffers of one device together: the disk gets
+// them at once, and takes consecutive blocks as one request.
+void
+bwritev(struct buf **b, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&b[i]->lock))
+      panic("bwritev");
+
+  if(n > 0 && b[0]->dev != RAIDDEV){
+    virtio_disk_rwv(VIRTIO0_ID, b, n, 1);
+  } else {
+    for(int i = 0; i < n; i++)
+      brw(b[i], 1);
+  }
+}
+
+// Return a locked buf for a block the caller overwrites whole,
+// so its old contents are not read from disk.
+struct buf*
+bclaim(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// It stays cached; CLOCK sees it was used.
 void
 brelse(struct buf *b)
 {
@@ -121,33 +260,78 @@ brelse(struct buf *b)
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // dev and blockno stay while refcnt is held
+  struct bucket *bk = bbucket(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bbucket(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bbucket(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Is block cached? It may be gone by the time the caller looks.
+static int
+bcached(uint dev, uint blockno)
+{
+  struct bucket *bk = bbucket(dev, blockno);
+
+  acquire(&bk->lock);
+  int cached = blookup(bk, dev, blockno) != 0;
+  release(&bk->lock);
+  return cached;
+}
+
+// Ask for block to be read into the cache soon.
+void
+breadahead(uint dev, uint blockno)
+{
+  acquire(&ra.lock);
+  if(ra.w - ra.r < NRA){
+    ra.req[ra.w % NRA].dev = dev;
+    ra.req[ra.w % NRA].blockno = blockno;
+    ra.w++;
+    wakeup(&ra);
+  }
+  release(&ra.lock);
 }
 
+// Kernel thread - reads queued blocks that are not cached.
+static void
+readahead(void)
+{
+  for(;;){
+    acquire(&ra.lock);
+    while(ra.r == ra.w)
+      sleep(&ra, &ra.lock);
+    uint dev = ra.req[ra.r % NRA].dev;
+    uint blockno = ra.req[ra.r % NRA].blockno;
+    ra.r++;
+    release(&ra.lock);
+
+    if(!bcached(dev, blockno))
+      brelse(bread(dev, blockno));
+  }
+}
 
+// Start read-ahead threads - they need a process to run in.
+void
+breadaheadinit(void)
+{
+  for(int i = 0; i < NRATHREAD; i++)
+    if(kthread("readahead", readahead) < 0)
+      panic("breadaheadinit");
+}
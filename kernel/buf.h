@@ -5,8 +5,8 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  uchar data[BSIZE];
+  int used;    // referenced since CLOCK last passed it
+  struct buf *hnext; // hash chain
+  uchar *data; // BSIZE bytes, in a kalloc'd page
 };
 
@@ -10,14 +10,22 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct DiskInfo;
+struct DiskPair;
+struct ioreq;
+struct RAIDStat;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+struct buf*     bclaim(uint, uint);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            breadahead(uint, uint);
+void            breadaheadinit(void);
 
 // console.c
 void            consoleinit(void);
@@ -88,6 +96,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             kthread(char*, void (*)(void));
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -189,26 +198,114 @@ void            plicinit(void);
 void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
+int             plic_affinity(int id, int hart);
+void            plic_steer(int id);
 
 // virtio_disk.c
 void            virtio_disk_init(int id, char* name);
 void            virtio_disk_rw(int id, struct buf *, int);
+void            virtio_disk_rwv(int id, struct buf **, int, int);
 void            virtio_disk_intr(int id);
+int             virtio_disk_start(int id, struct ioreq **r, int n, int wait);
+void            virtio_disk_wait(int id, struct ioreq *r);
+int             virtio_disk_poll(int id, int on);
 //                diskn is from [1, 7]
 void            write_block(int diskn, int blockno, uchar* data);
 void            read_block(int diskn, int blockno, uchar* data);
+void            write_blocks(int diskn, int blockno, int n, uchar* data);
+void            read_blocks(int diskn, int blockno, int n, uchar* data);
+void            copy_blocks(int fromdiskn, int todiskn, int blockno, int n);
+void            discard_blocks(int diskn, int blockno, int n);
+void            gather_blocks(int n, int* diskn, int* blockno, uchar** data);
+void            scatter_blocks(int n, int* diskn, int* blockno, uchar** data);
+
+// iosched.c
+void            iosched_init(int id);
+int             iosched_direct(void *p);
+int             iosched_policy(int id, int policy);
+void            iosched_submit(int id, struct ioreq *r, int n);
+void            iosched_wait(int id, struct ioreq *r);
+void            iosched_rw(int id, uint blockno, int n, uchar *data, int write);
+void            iosched_discard(int id, uint blockno, int n);
 
 // raid.c
 void            writeraidmeta();
+void            writeraidmetaheld();
 uint64          diskblockn();
+uint64          metablockn(void);
+uint64          discardblockn(void);
 uint64          raidblockn(void);
 void            loadraid(void);
-uint64          setraidtype(int type);
+uint64          setraidtype(int type, int layout, int members);
 uint64          readraid(int vblkn, uchar* data);
 uint64          writeraid(int vblkn, uchar* data);
 uint64          raidfail(int diskn);
 uint64          raidrepair(int diskn);
 uint64          raiddestroy(void);
+int             blockvalid(struct DiskInfo* disk, uint64 pblkn);
+int             mirrorloaded(struct DiskPair* diskpair, uint64 clustern);
+
+// raidspare.c
+void            raiddinit(void);
+void            sparefail(int diskn);
+void            sparerepair(int diskn);
+void            raidactivity(void);
+void            raiddwakeup(void);
+void            beginparityrepair(void);
+void            endparityrepair(void);
+
+// raidcsum.c
+void            csuminit(void);
+int             checksumraid(int on);
+uint32          crc32c(uchar* data, int n);
+void            csumwrite(int diskn, uint64 blockno, uchar* data);
+int             csumcheck(int diskn, uint64 blockno, uchar* data);
+void            csumclear(int diskn);
+void            csumcopy(int fromdiskn, int todiskn, uint64 from, uint64 to);
+void            csumforget(int diskn, uint64 from, uint64 to);
+
+// raiddiscard.c
+void            discardinit(void);
+uint64          discardraid(int blkn, int count);
+int             discarded(int vblkn);
+int             rowdiscarded(uint64 row);
+void            discardwrite(int vblkn);
+void            copyused(int fromdiskn, int todiskn, uint64 from, uint64 to);
+void            discardreset(void);
+void            discardrecount(void);
+
+// raidscrub.c
+void            scrubinit(void);
+int             scrubraid(int rate);
+int             canscrub(void);
+void            scrubstep(void);
+int             scrubxor(int* diskn, uint64* blockno, int n, int p);
+
+// raidreshape.c
+void            reshapeinit(void);
+uint64          reshaperaid(int disks);
+int             canreshape(void);
+void            reshapestep(void);
+void            raidiobegin(void);
+void            raidioend(void);
+
+// raidstat.c
+void            raidstat_diskstart(int diskn);
+void            raidstat_diskdone(int diskn, int write, int n, uint64 start);
+void            raidstat_array(int write, int failed, uint64 start);
+void            raidstat_event(int event);
+void            raidstat_bcache(int miss);
+void            raidstat_sum(struct RAIDStat* sum);
+
+// trace.c
+void            traceinit(void);
+void            tracefor(uint32 req, int event, int disk, uint64 arg);
+uint32          tracereq(void);
+void            trace(int event, uint64 arg);
+void            tracebegin(int write);
+void            traceend(int failed);
+int             tracelock(char* name);
+int             tracedrain(int on, uint64 dst, int n);
 
 
 // number of elements in fixed-size array
@@ -216,4 +313,9 @@ uint64          raiddestroy(void);
 
 #define VIRTIO0_ID 0
 #define VIRTIO_RAID_DISK_START (1)
-#define VIRTIO_RAID_DISK_END (DISKS)
+#ifndef SPARES
+#define SPARES 0
+#endif
+
+// hot spares follow RAID disks
+#define VIRTIO_RAID_DISK_END (DISKS + SPARES)
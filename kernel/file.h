@@ -27,6 +27,10 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  uint raoff;         // where the last read ended - a read from there is sequential
+  uint ranext;        // first file block not yet read ahead
+  uint rawin;         // blocks read ahead of a sequential reader, 0 if not
 };
 
 // map major device number to device functions.
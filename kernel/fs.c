@@ -271,6 +271,7 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->raoff = ip->ranext = ip->rawin = 0;
   release(&itable.lock);
 
   return ip;
@@ -464,6 +465,67 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Disk block of file block bn, or 0 if it has none.
+// Unlike bmap, never allocates.
+static uint
+bmapped(struct inode *ip, uint bn)
+{
+  uint addr;
+  struct buf *bp;
+
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+
+  if(bn >= NINDIRECT || ip->addrs[NDIRECT] == 0)
+    return 0;
+  bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  addr = ((uint*)bp->data)[bn];
+  brelse(bp);
+  return addr;
+}
+
+// Read-ahead for a read of n bytes at off.
+// A read that starts where the last one ended is sequential:
+// the window of blocks read ahead of it doubles, from RAMIN
+// up to RAMAX, and the blocks of the window not asked for yet
+// go to breadahead. Any other read closes the window.
+// Caller must hold ip->lock.
+#define RAMIN 4
+#define RAMAX 32
+
+static void
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end;
+
+  if(n == 0)
+    return;
+
+  if(off == ip->raoff){
+    ip->rawin = ip->rawin ? min(2 * ip->rawin, RAMAX) : RAMIN;
+  } else {
+    ip->rawin = 0;
+    ip->ranext = 0;
+  }
+  ip->raoff = off + n;
+  if(ip->rawin == 0)
+    return;
+
+  // blocks after the last one of this read, within the file
+  bn = (off + n - 1) / BSIZE + 1;
+  end = min(bn + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  if(ip->ranext > bn)
+    bn = ip->ranext;
+  for(; bn < end; bn++){
+    uint addr = bmapped(ip, bn);
+    if(addr == 0)
+      break;
+    breadahead(ip->dev, addr);
+  }
+  ip->ranext = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -479,6 +541,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  ireadahead(ip, off, n);
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
@@ -0,0 +1,350 @@
+//
+// per-disk I/O scheduler.
+//
+// requests wait in a queue of their disk, and only IOSCHED_DEPTH batches
+// per disk are in virtio at a time, so the queue has time to fill up and be sorted.
+// a batch is the request picked by the policy together with queued requests
+// that continue it (same direction, next block) - virtio moves them with
+// one request.
+//
+// noop serves requests in order of arrival. deadline serves them in block
+// order (one-way elevator), prefers reads, and serves a request that
+// waited too long before anything else.
+//
+// with nothing queued, requests go straight to the virtqueue of the hart,
+// without the lock of the disk queue, so harts submitting to one disk do
+// not serialize - noop always, deadline while the disk has room for
+// another batch, as there is nothing to sort then. such a request takes
+// its batch without the lock, so batches is only changed atomically.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "iosched.h"
+#include "trace.h"
+
+static struct ioqueue {
+  struct spinlock lock;
+  struct ioreq *head;   // waiting requests, in order of arrival
+  int batches;          // batches in virtio, not yet waited for - atomic
+  int policy;           // enum IOSCHED_POLICY
+  uint lastblock;       // block after the last batch - elevator goes on from it
+  int starved;          // read batches dispatched while writes waited
+} queue[VIRTIO_RAID_DISK_END + 1];
+
+void
+iosched_init(int id)
+{
+  initlock(&queue[id].lock, "ioqueue");
+  queue[id].head = 0;
+  queue[id].batches = 0;
+  queue[id].policy = IOSCHED_DEADLINE;
+  queue[id].lastblock = 0;
+  queue[id].starved = 0;
+}
+
+// can the device use the address - kernel stacks are not mapped one to one
+int
+iosched_direct(void *p)
+{
+  return (uint64)p >= KERNBASE && (uint64)p + BSIZE <= PHYSTOP;
+}
+
+// set policy of disk id, policy < 0 only asks. returns the old policy.
+int
+iosched_policy(int id, int policy)
+{
+  struct ioqueue *q = &queue[id];
+
+  acquire(&q->lock);
+  int old = q->policy;
+  if(policy >= 0)
+    q->policy = policy;
+  release(&q->lock);
+
+  return old;
+}
+
+// deadline - pick direction, then expired request or the next one in block order
+static struct ioreq*
+pickdeadline(struct ioqueue *q)
+{
+  int reads = 0, writes = 0;
+  for(struct ioreq *r = q->head; r; r = r->next){
+    if(r->write)
+      writes++;
+    else
+      reads++;
+  }
+
+  int write = !(reads && (!writes || q->starved < WRITES_STARVED));
+  if(write)
+    q->starved = 0;
+  else if(writes)
+    q->starved++;
+
+  // the first one of the direction is the oldest
+  for(struct ioreq *r = q->head; r; r = r->next){
+    if(r->write == write){
+      if((int)(ticks - r->deadline) >= 0)
+        return r;
+      break;
+    }
+  }
+
+  struct ioreq *next = 0, *lowest = 0;
+  for(struct ioreq *r = q->head; r; r = r->next){
+    if(r->write != write)
+      continue;
+    if(r->blockno >= q->lastblock && (!next || r->blockno < next->blockno))
+      next = r;
+    if(!lowest || r->blockno < lowest->blockno)
+      lowest = r;
+  }
+
+  // nothing after the last batch - start again from the lowest block
+  return next ? next : lowest;
+}
+
+static void
+dequeue(struct ioqueue *q, struct ioreq *r)
+{
+  for(struct ioreq **pp = &q->head; *pp; pp = &(*pp)->next){
+    if(*pp == r){
+      *pp = r->next;
+      return;
+    }
+  }
+  panic("iosched dequeue");
+}
+
+// take one of the IOSCHED_DEPTH batches of the disk, returns 0 if all are in virtio
+static int
+takebatch(struct ioqueue *q)
+{
+  // the queue was changed before - a waiter giving its batch back sees it then (iosched_wait)
+  __sync_synchronize();
+  for(;;){
+    int b = *(volatile int *)&q->batches;
+    if(b >= IOSCHED_DEPTH)
+      return 0;
+    if(__sync_bool_compare_and_swap(&q->batches, b, b + 1))
+      return 1;
+  }
+}
+
+// give one batch to virtio, returns 0 if there were no descriptors for it.
+// q->lock must be held, and a batch taken.
+static int
+dispatchbatch(int id)
+{
+  struct ioqueue *q = &queue[id];
+  struct ioreq *batch[IOSCHED_MERGE];
+  batch[0] = q->policy == IOSCHED_DEADLINE ? pickdeadline(q) : q->head;
+
+  // merge requests that continue the batch
+  int n = 1, blocks = batch[0]->n;
+  while(n < IOSCHED_MERGE && !batch[0]->discard){
+    struct ioreq *r;
+    uint end = batch[n-1]->blockno + batch[n-1]->n;
+    for(r = q->head; r; r = r->next)
+      if(r->write == batch[0]->write && !r->discard && r->blockno == end)
+        break;
+    if(!r || blocks + r->n > IOSCHED_MERGE)
+      break;
+    batch[n++] = r;
+    blocks += r->n;
+  }
+
+  // dequeue before virtio links the batch through next.
+  // nothing of a started request is read after - its waiter may be gone
+  uint end[IOSCHED_MERGE];
+  int waiting[IOSCHED_MERGE];
+  for(int i = 0; i < n; i++){
+    dequeue(q, batch[i]);
+    end[i] = batch[i]->blockno + batch[i]->n;
+    waiting[i] = batch[i]->waiting;
+  }
+
+  int started = virtio_disk_start(id, batch, n, 0);
+
+  // waiters of queued requests wait for their virtqueue (iosched_wait)
+  for(int i = 0; i < started; i++)
+    if(waiting[i])
+      wakeup(batch[i]);
+
+  // the rest go back to the front, they were there first
+  for(int i = n - 1; i >= started; i--){
+    batch[i]->next = q->head;
+    q->head = batch[i];
+  }
+
+  if(started == 0)
+    return 0;
+
+  q->lastblock = end[started-1];
+  return 1;
+}
+
+// give next batches to virtio, while the disk has room for them.
+// q->lock must be held.
+static void
+dispatch(int id)
+{
+  struct ioqueue *q = &queue[id];
+
+  while(q->head && takebatch(q)){
+    if(!dispatchbatch(id)){
+      __sync_fetch_and_sub(&q->batches, 1);
+      break;
+    }
+  }
+}
+
+// give requests to virtio in order, consecutive ones as one request,
+// waiting for descriptors when needed. with batch, every virtio request
+// takes a batch of the disk first - returns how many requests went before
+// there was none left.
+static int
+submitdirect(int id, struct ioreq *r, int n, int batch)
+{
+  struct ioqueue *q = &queue[id];
+  struct ioreq *run[IOSCHED_MERGE];
+
+  for(int i = 0; i < n; i++){
+    r[i].done = 0;
+    r[i].waiting = 0;
+    r[i].queue = -1;
+    r[i].batch = batch;
+  }
+
+  for(int i = 0; i < n; ){
+    int k = 1, blocks = r[i].n;
+    run[0] = &r[i];
+    while(i + k < n && k < IOSCHED_MERGE && blocks + r[i+k].n <= IOSCHED_MERGE && !r[i].discard && !r[i+k].discard &&
+          r[i+k].write == r[i].write && r[i+k].blockno == r[i+k-1].blockno + r[i+k-1].n){
+      run[k] = &r[i+k];
+      blocks += r[i+k].n;
+      k++;
+    }
+
+    for(int started = 0; started < k; ){
+      if(batch && !takebatch(q))
+        return i + started;
+      started += virtio_disk_start(id, run + started, k - started, 1);
+    }
+    i += k;
+  }
+  return n;
+}
+
+// put n requests in queue of disk id at once, so they can be merged
+void
+iosched_submit(int id, struct ioreq *r, int n)
+{
+  struct ioqueue *q = &queue[id];
+
+  for(int i = 0; i < n; i++){
+    r[i].start = r_time();
+    raidstat_diskstart(id);
+    r[i].trace = tracereq();
+    tracefor(r[i].trace, TR_SUBMIT, id, r[i].blockno);
+  }
+
+  // queued requests go first - they were there before
+  if(*(struct ioreq * volatile *)&q->head == 0){
+    int started = submitdirect(id, r, n, *(volatile int *)&q->policy != IOSCHED_NOOP);
+    r += started;
+    n -= started;
+    if(n == 0)
+      return;
+  }
+
+  acquire(&q->lock);
+  struct ioreq **pp = &q->head;
+  while(*pp)
+    pp = &(*pp)->next;
+  for(int i = 0; i < n; i++){
+    r[i].done = 0;
+    r[i].waiting = 0;
+    r[i].queue = -1;
+    r[i].batch = 1;
+    r[i].next = 0;
+    r[i].deadline = ticks + (r[i].write ? WRITE_EXPIRE : READ_EXPIRE);
+    *pp = &r[i];
+    pp = &r[i].next;
+  }
+  dispatch(id);
+  release(&q->lock);
+}
+
+// wait for request, then let the next batch go
+void
+iosched_wait(int id, struct ioreq *r)
+{
+  struct ioqueue *q = &queue[id];
+
+  // still in the queue - it has no virtqueue to wait on until dispatch starts it, under q->lock
+  if(*(volatile int *)&r->queue < 0){
+    acquire(&q->lock);
+    while(r->queue < 0){
+      r->waiting = 1;
+      sleep(r, &q->lock);
+    }
+    release(&q->lock);
+  }
+
+  virtio_disk_wait(id, r);
+
+  // the first request of a virtio request owned its descriptors, and its batch
+  if(r->desc < 0)
+    return;
+  if(r->batch)
+    __sync_fetch_and_sub(&q->batches, 1);
+
+  // queued requests may wait for either
+  __sync_synchronize();
+  if(*(struct ioreq * volatile *)&q->head){
+    acquire(&q->lock);
+    dispatch(id);
+    release(&q->lock);
+  }
+}
+
+// n blocks from blockno, data is n * BSIZE bytes mapped one to one
+void
+iosched_rw(int id, uint blockno, int n, uchar *data, int write)
+{
+  struct ioreq r;
+
+  r.write = write;
+  r.discard = 0;
+  r.callback = 0;
+  r.blockno = blockno;
+  r.n = n;
+  r.data = data;
+  iosched_submit(id, &r, 1);
+  iosched_wait(id, &r);
+}
+
+// n blocks from blockno hold nothing any more - queued like a write
+void
+iosched_discard(int id, uint blockno, int n)
+{
+  struct ioreq r;
+
+  r.write = 1;
+  r.discard = 1;
+  r.callback = 0;
+  r.blockno = blockno;
+  r.n = n;
+  r.data = 0;
+  iosched_submit(id, &r, 1);
+  iosched_wait(id, &r);
+}
@@ -0,0 +1,38 @@
+// per-disk I/O scheduler between RAID engines (read_block, write_block) and virtio.
+
+// scheduling policies
+enum IOSCHED_POLICY {IOSCHED_NOOP, IOSCHED_DEADLINE};
+
+// where completion interrupts of a RAID disk go (plic_affinity) - a hart, or one of these
+enum IRQ_AFFINITY {IRQ_SUBMITTER = -3, IRQ_ANY = -2};
+
+// most blocks dispatched together as one merged virtio request
+#define IOSCHED_MERGE 64
+// batches of a disk in virtio at a time - more keep the device busy, fewer leave more to sort
+#define IOSCHED_DEPTH 4
+
+// ticks a request may wait before it is served ahead of the elevator
+#define READ_EXPIRE 1
+#define WRITE_EXPIRE 5
+// read batches in a row while writes wait
+#define WRITES_STARVED 2
+
+// request for consecutive blocks, waits in queue of its disk until dispatched
+struct ioreq {
+  int write;
+  int discard;          // write that drops the blocks instead - no data, never merged
+  uint blockno;
+  int n;                // number of blocks
+  uchar *data;          // n * BSIZE bytes the device reads or writes - must be mapped one to one
+  uint deadline;        // ticks when request expires
+  uint64 start;         // time CSR when submitted, for statistics
+  uint32 trace;         // RAID request it is part of, for trace
+  void (*callback)(struct ioreq *r);  // run by virtio_disk_harvest on completion, under lock of the virtqueue - must not sleep
+  void *arg;            // for callback
+  int done;             // set by virtio_disk_harvest, after callback - waiter may return at once
+  int waiting;          // waiter sleeps on the request - only then dispatch or virtio_disk_harvest wakes it up
+  int desc;             // head of descriptor chain given to virtio, -1 if another request of the chain owned it
+  int queue;            // virtqueue of the disk it was given to, -1 while it waits in the queue of the disk
+  int batch;            // holds a batch of the disk while in virtio - not a noop request past the queue
+  struct ioreq *next;   // queue of the disk in order of arrival, then next request of the same virtio request
+};
@@ -1,5 +1,6 @@
 #include "types.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
@@ -15,6 +16,11 @@
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
+// Group commit: when other calls ran in the same transaction,
+// the last end_op() waits up to GROUPWINDOW for more of them to
+// join before it commits, so one commit carries them all. The
+// window closes early when the log has no room for another call.
+//
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
@@ -28,7 +34,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous. The log blocks go to the disk
+// as one request, and installs to home locations all at once.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -37,12 +44,22 @@ struct logheader {
   int block[LOGSIZE];
 };
 
+// time CSR cycles a commit waits for more calls to join (0.5 ms)
+#define GROUPWINDOW (TIMEBASE / 2000)
+
+// commit holds every logged block and its log block at once
+#if NBUF < 3 * LOGSIZE
+#error "NBUF too small for the log"
+#endif
+
 struct log {
   struct spinlock lock;
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
+  int closing;     // an end_op() will commit - others just leave.
   int committing;  // in commit(), please wait.
+  int joined;      // FS sys calls in this transaction so far.
   int dev;
   struct logheader lh;
 };
@@ -68,17 +85,26 @@ initlog(int dev, struct superblock *sb)
 static void
 install_trans(int recovering)
 {
+  struct buf *dbuf[LOGSIZE];
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    if(recovering){
+      // after a crash the blocks are only in the log; otherwise
+      // the pinned cache block already holds what was logged
+      dbuf[tail] = bclaim(log.dev, log.lh.block[tail]); // dst, overwritten whole
+      struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+      memmove(dbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    } else {
+      dbuf[tail] = bread(log.dev, log.lh.block[tail]); // read dst
+    }
+  }
+  bwritev(dbuf, log.lh.n);  // write all dst to disk at once
+  for (tail = 0; tail < log.lh.n; tail++) {
     if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+      bunpin(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -135,14 +161,34 @@ begin_op(void)
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.joined += 1;
       release(&log.lock);
       break;
     }
   }
 }
 
+// Wait while other FS sys calls may still join the transaction:
+// it has blocks to commit, some calls ran in it besides the
+// closing one, the window is open, and the log has room for one more.
+static void
+groupwait(void)
+{
+  uint64 start = r_time();
+
+  acquire(&log.lock);
+  while(log.lh.n > 0 && log.joined > 1 && r_time() - start < GROUPWINDOW &&
+        log.lh.n + (log.outstanding+1)*MAXOPBLOCKS <= LOGSIZE){
+    release(&log.lock);
+    yield();
+    acquire(&log.lock);
+  }
+  release(&log.lock);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless another end_op() is about to.
 void
 end_op(void)
 {
@@ -150,25 +196,34 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.outstanding == 0 && !log.closing){
     do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    log.closing = 1;
   }
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space. The closing
+  // end_op() may be waiting for the last call.
+  wakeup(&log);
   release(&log.lock);
 
   if(do_commit){
+    groupwait();
+
+    // no more calls join; wait for those that did
+    acquire(&log.lock);
+    log.committing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    release(&log.lock);
+
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
     acquire(&log.lock);
     log.committing = 0;
+    log.closing = 0;
+    log.joined = 0;
     wakeup(&log);
     release(&log.lock);
   }
@@ -178,16 +233,18 @@ end_op(void)
 static void
 write_log(void)
 {
+  struct buf *to[LOGSIZE];
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+    to[tail] = bclaim(log.dev, log.start+tail+1); // log block, overwritten whole
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(to[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
+  bwritev(to, log.lh.n);  // write the log - consecutive blocks, one request
+  for (tail = 0; tail < log.lh.n; tail++)
+    brelse(to[tail]);
 }
 
 static void
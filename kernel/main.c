@@ -27,6 +27,7 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    traceinit();     // RAID trace rings
     virtio_disk_init(VIRTIO0_ID, "program_disk"); // emulated hard disk 0, with programs
 
     for (int i = VIRTIO_RAID_DISK_START; i <= VIRTIO_RAID_DISK_END; i++) {
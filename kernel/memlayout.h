@@ -36,6 +36,9 @@
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
+// frequency of the time CSR (CLINT_MTIME), 10 MHz on qemu virt.
+#define TIMEBASE 10000000L
+
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
@@ -68,6 +71,15 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   VCLOCK (read-only, shared by all processes, used by nanotime() in ulib.c)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define VCLOCK (TRAPFRAME - PGSIZE)
+
+#ifndef __ASSEMBLER__
+// what the VCLOCK page holds - user mode reads the time CSR itself
+struct vclock {
+  uint64 hz;            // ticks of the time CSR per second
+};
+#endif
@@ -4,10 +4,17 @@
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
+#define RAIDDEV       2  // device number of RAID volume, for bread/bwrite
+#ifdef ROOTRAID
+#define ROOTDEV RAIDDEV  // file system lives on the RAID volume
+#else
 #define ROOTDEV       1  // device number of file system root disk
+#endif
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#ifndef NBUF
+#define NBUF        512  // size of disk block cache - make NBUF=n
+#endif
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
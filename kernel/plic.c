@@ -2,21 +2,61 @@
 #include "param.h"
 #include "memlayout.h"
 #include "riscv.h"
+#include "spinlock.h"
 #include "defs.h"
+#include "iosched.h"
 
 //
 // the riscv Platform Level Interrupt Controller (PLIC).
 //
+// the uart and disk 0 interrupt every hart. a RAID disk interrupts
+// only the harts its affinity picks: one hart, every hart, or
+// (default) the hart that last submitted to it, so its completions
+// are handled where its requests came from.
+//
+
+static struct spinlock pliclock;   // protects enable bits, affinity and target
+static int hartup[NCPU];           // plicinithart ran on hart
+static int affinity[VIRTIO_RAID_DISK_END + 1];   // hart, or enum IRQ_AFFINITY
+static int target[VIRTIO_RAID_DISK_END + 1];     // hart that gets the interrupts now, -1 every hart
+
+// write enable bits of hart. pliclock must be held.
+static void
+setenable(int hart)
+{
+  uint32 enable_bits = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
+  for (int i = VIRTIO_RAID_DISK_START; i <= VIRTIO_RAID_DISK_END; i++) {
+    if (target[i] < 0 || target[i] == hart)
+      enable_bits |= (1 << VIRTIOX_IRQ(i));
+  }
+
+  *(uint32*)PLIC_SENABLE(hart) = enable_bits;
+}
+
+// send interrupts of disk id to hart (-1 every hart). pliclock must be held.
+static void
+settarget(int id, int hart)
+{
+  target[id] = hart;
+  for (int h = 0; h < NCPU; h++) {
+    if (hartup[h])
+      setenable(h);
+  }
+}
 
 void
 plicinit(void)
 {
+  initlock(&pliclock, "plic");
+
   // set desired IRQ priorities non-zero (otherwise disabled).
   *(uint32*)(PLIC + UART0_IRQ*4) = 1;
   *(uint32*)(PLIC + VIRTIO0_IRQ*4) = 1;
 
   for (int i = VIRTIO_RAID_DISK_START; i <= VIRTIO_RAID_DISK_END; i++) {
     *(uint32*)(PLIC + VIRTIOX_IRQ(i)*4) = 1;
+    affinity[i] = IRQ_SUBMITTER;
+    target[i] = -1;
   }
 }
 
@@ -26,18 +66,56 @@ plicinithart(void)
   int hart = cpuid();
   
   // set enable bits for this hart's S-mode
-  // for the uart and virtio disk.
-  uint32 enable_bits = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
-  for (int i = VIRTIO_RAID_DISK_START; i <= VIRTIO_RAID_DISK_END; i++) {
-    enable_bits |= (1 << VIRTIOX_IRQ(i));
-  }
-
-  *(uint32*)PLIC_SENABLE(hart) = enable_bits;
+  // for the uart and virtio disks.
+  acquire(&pliclock);
+  hartup[hart] = 1;
+  setenable(hart);
+  release(&pliclock);
 
   // set this hart's S-mode priority threshold to 0.
   *(uint32*)PLIC_SPRIORITY(hart) = 0;
 }
 
+// set affinity of disk id: a hart, IRQ_ANY or IRQ_SUBMITTER, -1 only asks.
+// returns the old affinity, -1 if the hart is not running.
+int
+plic_affinity(int id, int hart)
+{
+  if (hart >= NCPU || (hart >= 0 && !hartup[hart]))
+    return -1;
+
+  acquire(&pliclock);
+  int old = affinity[id];
+  if (hart != -1) {
+    affinity[id] = hart;
+    if (hart >= 0)
+      settarget(id, hart);
+    else if (hart == IRQ_ANY || target[id] < 0 || !hartup[target[id]])
+      settarget(id, -1);
+    // IRQ_SUBMITTER moves with the next request
+  }
+  release(&pliclock);
+
+  return old;
+}
+
+// a request of disk id was given to the device - with IRQ_SUBMITTER
+// steer its interrupts to this hart. interrupts must be off.
+void
+plic_steer(int id)
+{
+  int hart = cpuid();
+
+  // cheap look first - usually nothing changes
+  if (affinity[id] != IRQ_SUBMITTER || target[id] == hart)
+    return;
+
+  acquire(&pliclock);
+  if (affinity[id] == IRQ_SUBMITTER && target[id] != hart)
+    settarget(id, hart);
+  release(&pliclock);
+}
+
 // ask the PLIC what interrupt we should serve.
 int
 plic_claim(void)
@@ -52,5 +130,19 @@ void
 plic_complete(int irq)
 {
   int hart = cpuid();
+
+  if (irq >= VIRTIOX_IRQ(VIRTIO_RAID_DISK_START) && irq <= VIRTIOX_IRQ(VIRTIO_RAID_DISK_END)) {
+    // the PLIC ignores completion of an IRQ that is not enabled for the hart,
+    // and the disk would never interrupt again - affinity may have moved it
+    // since the claim, so enable it for the completion.
+    acquire(&pliclock);
+    uint32 enable_bits = *(uint32*)PLIC_SENABLE(hart);
+    *(uint32*)PLIC_SENABLE(hart) = enable_bits | (1 << irq);
+    *(uint32*)PLIC_SCLAIM(hart) = irq;
+    *(uint32*)PLIC_SENABLE(hart) = enable_bits;
+    release(&pliclock);
+    return;
+  }
+
   *(uint32*)PLIC_SCLAIM(hart) = irq;
 }
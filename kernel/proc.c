@@ -15,7 +15,14 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// the VCLOCK page - a whole page, so nothing else of the kernel is visible to user mode
+static union {
+  struct vclock clock;
+  char page[PGSIZE];
+} vclock __attribute__((aligned(PGSIZE))) = { .clock = { .hz = TIMEBASE } };
+
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -165,6 +172,7 @@ freeproc(struct proc *p)
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
+  p->kfn = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
@@ -202,6 +210,16 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the clock page below the trapframe, read-only
+  // for user mode, so nanotime() needs no system call.
+  if(mappages(pagetable, VCLOCK, PGSIZE,
+              (uint64)&vclock, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -212,6 +230,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, VCLOCK, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -524,14 +543,56 @@ forkret(void)
     // regular process (e.g., because it calls sleep), and thus cannot
     // be run from main().
     first = 0;
-    fsinit(ROOTDEV);
-    // LOAD RAID STRUCTURE, WHEN FILE SYSTEM IS INITIALIZED AND IS RUNNING ON USER THREAD!
+    // LOAD RAID STRUCTURE, WHEN RUNNING ON USER THREAD - before the file system, which may live on it
     loadraid();
+    fsinit(ROOTDEV);
+    breadaheadinit();
+    // background rebuild onto hot spares
+    raiddinit();
   }
 
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret, which runs its function
+// and never returns to user space.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
+// Create a process that runs fn in the kernel,
+// e.g. background work of the RAID layer.
+// Returns its pid, or -1 if there is no free proc.
+int
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+
+  p->context.ra = (uint64)kthreadret;
+  p->kfn = fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+
+  p->state = RUNNABLE;
+
+  release(&p->lock);
+
+  return pid;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
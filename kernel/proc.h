@@ -104,4 +104,6 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Function of kernel thread, 0 for user processes
+  uint32 tracereq;             // RAID request traced events belong to, 0 if none
 };
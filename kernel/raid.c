@@ -7,18 +7,31 @@
 #include "sleeplock.h"
 #include "defs.h"
 #include "raid.h"
+#include "raidstat.h"
+#include "trace.h"
 
 uint64 raid0read(int vblkn, uchar* data);
 uint64 raid1read(int vblkn, uchar* data);
 uint64 raid0_1read(int vblkn, uchar* data);
 uint64 raid4read(int vblkn, uchar* data);
 uint64 raid5read(int vblkn, uchar* data);
+uint64 raid6read(int vblkn, uchar* data);
+uint64 raid5dread(int vblkn, uchar* data);
 
 uint64 raid0write(int vblkn, uchar* data);
 uint64 raid1write(int vblkn, uchar* data);
 uint64 raid0_1write(int vblkn, uchar* data);
 uint64 raid4write(int vblkn, uchar* data);
 uint64 raid5write(int vblkn, uchar* data);
+uint64 raid6write(int vblkn, uchar* data);
+uint64 raid5dwrite(int vblkn, uchar* data);
+
+void gfinit(void);
+void repairraid6(int diskn, uint64 from, uint64 to);
+uint64 tilesraid5d(void);
+uint64 raid5members(uint64 stripe);
+void sparefailraid5d(int diskn);
+int repairraid5d(int diskn);
 
 // virtual function table
 uint64 (*readtable[])(int vblkn, uchar* data) =
@@ -27,7 +40,9 @@ uint64 (*readtable[])(int vblkn, uchar* data) =
         [RAID1] = raid1read,
         [RAID0_1] = raid0_1read,
         [RAID4] = raid4read,
-        [RAID5] = raid5read
+        [RAID5] = raid5read,
+        [RAID6] = raid6read,
+        [RAID5D] = raid5dread
 };
 
 uint64 (*writetable[])(int vblkn, uchar* data) =
@@ -36,12 +51,29 @@ uint64 (*writetable[])(int vblkn, uchar* data) =
         [RAID1] = raid1write,
         [RAID0_1] = raid0_1write,
         [RAID4] = raid4write,
-        [RAID5] = raid5write
+        [RAID5] = raid5write,
+        [RAID6] = raid6write,
+        [RAID5D] = raid5dwrite
 };
 
 // global variable
 struct RAIDMeta raidmeta;
 
+// all disk locks must be held when called
+void
+writeraidmetaheld()
+{
+    //printf("cuva raidmeta\n");
+    // write structure on last block on every disk, hot spares included
+    // disk 1 is read on boot, so it must get the structure even after a hot spare took its place
+    for (int i = VIRTIO_RAID_DISK_START; i <= VIRTIO_RAID_DISK_END; i++)
+    {
+        uchar data[BSIZE] = {0};
+        memmove(data, &raidmeta, sizeof(raidmeta));
+        write_block(i, metablockn(), data);
+    }
+}
+
 void
 writeraidmeta()
 {
@@ -49,19 +81,7 @@ writeraidmeta()
     for (int i = 0; i < DISKS; i++)
         acquiresleep(&raidmeta.diskinfo[i].lock);
 
-    //printf("cuva raidmeta\n");
-    // write structure on last block on every disk
-    for (int i = 1; i <= DISKS; i++)
-    {
-        struct DiskInfo* diskInfo = raidmeta.diskinfo + i;
-        if (diskInfo->valid)
-        {
-            uchar data[BSIZE] = {0};
-            memmove(data, &raidmeta, sizeof(raidmeta));
-            int lastblockondisk = diskblockn();
-            write_block(i, lastblockondisk, data);
-        }
-    }
+    writeraidmetaheld();
 
     // release all disk locks
     for (int i = 0; i < DISKS; i++)
@@ -70,9 +90,23 @@ writeraidmeta()
 
 // DISK_SIZE_BYTES - in bytes
 // BSIZE - size of block in bytes
-// returns last free block on disk -> -1 because it counts from 0
+// returns number of data blocks on disk - checksum region, discard bitmap and raidmeta follow them
 uint64
 diskblockn()
+{
+    return DISK_SIZE_BYTES / BSIZE - 1 - CSUM_BLOCKS - DISCARD_BLOCKS;
+}
+
+// first block of discard bitmap
+uint64
+discardblockn(void)
+{
+    return metablockn() - DISCARD_BLOCKS;
+}
+
+// last block on disk holds raidmeta
+uint64
+metablockn(void)
 {
     return DISK_SIZE_BYTES / BSIZE - 1;
 }
@@ -84,7 +118,7 @@ raidblockn(void)
     switch (raidmeta.type)
     {
         case RAID0:
-            return diskblockn() * DISKS;
+            return diskblockn() * raidmeta.members;         // grows only when reshape is done
         case RAID1:
             return diskblockn() * ((DISKS+1) / 2);      //when odd number of disks -> one is not mirrored, but used for efficiency
         case RAID0_1:
@@ -92,19 +126,82 @@ raidblockn(void)
         case RAID4:
             return diskblockn() * (DISKS - 1);
         case RAID5:
-            return diskblockn() * (DISKS - 1);
+            return diskblockn() * (raidmeta.members - 1);
+        case RAID6:
+            return diskblockn() * (DISKS - 2);
+        case RAID5D:
+            return tilesraid5d() * DCL_TILE_DATA;
         default:
             panic("bad raid type\n");
     }
 }
 
+// locks of raid type were saved on disk in whatever state they were - set them up again
+// (background rebuild continues after boot and needs them)
+static void
+reloadraidlocks(void)
+{
+    switch (raidmeta.type)
+    {
+        case RAID1:
+        case RAID0_1:
+        {
+            struct DiskPair* diskpair = raidmeta.type == RAID1 ? raidmeta.data.raid1.diskpair : raidmeta.data.raid0_1.diskpair;
+            int pairs = raidmeta.type == RAID1 ? (DISKS + 1) / 2 : DISKS / 2;
+            for (int i = 0; i < pairs; i++)
+            {
+                initlock(&diskpair[i].mutex, "raidlock");
+                diskpair[i].writing = 0;
+                for (int j = 0; j < 2; j++)
+                    diskpair[i].reading[j] = 0;
+            }
+            break;
+        }
+        case RAID4:
+        {
+            struct RAID4Data* raiddata = &raidmeta.data.raid4;
+            initsleeplock(&raiddata->clusterlock, "clusterlock");
+            initlock(&raiddata->repairlock, "repairlock_raid4");
+            raiddata->repairing = raiddata->writecount = 0;
+            break;
+        }
+        case RAID5:
+        {
+            struct RAID5Data* raiddata = &raidmeta.data.raid5;
+            initsleeplock(&raiddata->clusterlock, "clusterlock");
+            initlock(&raiddata->repairlock, "repairlock_raid5");
+            raiddata->repairing = raiddata->writecount = 0;
+            break;
+        }
+        case RAID6:
+        {
+            struct RAID6Data* raiddata = &raidmeta.data.raid6;
+            initsleeplock(&raiddata->clusterlock, "clusterlock");
+            initlock(&raiddata->repairlock, "repairlock_raid6");
+            raiddata->repairing = raiddata->writecount = 0;
+            break;
+        }
+        case RAID5D:
+        {
+            struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+            initsleeplock(&raiddata->clusterlock, "clusterlock");
+            initlock(&raiddata->repairlock, "repairlock_raid5d");
+            raiddata->repairing = raiddata->writecount = 0;
+            break;
+        }
+        default:
+        {}
+    }
+}
+
 // initialize raid structure when booting
 void
 loadraid(void)
 {
+    csuminit();
+
     uchar data[BSIZE];
-    int lastblockondisk = diskblockn();
-    read_block(1, lastblockondisk, data);
+    read_block(1, metablockn(), data);
 
     // extract raidmeta structure from block - must read in every case
     memmove(&raidmeta, data, sizeof(raidmeta));
@@ -133,9 +230,20 @@ loadraid(void)
         initsleeplock(&raidmeta.diskinfo[i].lock, "diskinfolock");
     }
 
+    // tables are not saved on disk
+    gfinit();
+
     if (prevState == 1)
     {
 //        printf("MAXDIRTY je sacuvan: %d\n", raidmeta.maxdirty);
+        // saved function pointers are from the kernel that wrote them - take them from tables of this one
+        if (raidmeta.type >= RAID0 && raidmeta.type <= RAID5D)
+        {
+            raidmeta.read = readtable[raidmeta.type];
+            raidmeta.write = writetable[raidmeta.type];
+        }
+        reloadraidlocks();
+        discardinit();
         return;                 // already initialized raidmeta in previous run, just return
     }
 
@@ -151,11 +259,27 @@ loadraid(void)
     }
     raidmeta.diskinfo[DISKS].valid = 0;
 
+    // disks after RAID disks are hot spares
+    for (int i = 0; i < SPARES; i++)
+    {
+        raidmeta.spare[i] = DISKS + 1 + i;
+        raidmeta.sparefailed[i] = 0;
+    }
+    raidmeta.rebuilding = -1;
+    raidmeta.rebuildpos = 0;
+
+    raidmeta.members = raidmeta.newmembers = DISKS;
+    raidmeta.reshapepos = 0;
+    raidmeta.reshapebackup = -1;
+
+    raidmeta.scrubpos = 0;
+    raidmeta.scrubrate = 0;
+    raidmeta.scrubfound = 0;
 
     //initlock(&raidmeta.dirty, "raidmetadirty");
     //raidmeta.maxdirty = -1;
 
-    if (raidmeta.type >= RAID0 && raidmeta.type <= RAID5)
+    if (raidmeta.type >= RAID0 && raidmeta.type <= RAID5D)
     {
         raidmeta.read = readtable[raidmeta.type];
         raidmeta.write = writetable[raidmeta.type];
@@ -165,19 +289,45 @@ loadraid(void)
         raidmeta.read = raidmeta.write = 0;
     }
     writeraidmeta();
+    discardinit();
 }
 
 uint64
-setraidtype(int type)
+setraidtype(int type, int layout, int members)
 {
-    if (type < RAID0 || type > RAID5)
+    if (type < RAID0 || type > RAID5D)
         panic("invalid raid type");
 
+    // only RAID5 has more than one layout
+    if (layout < 0 || (type == RAID5 && layout > LEFT_ASYMMETRIC) || (type != RAID5 && layout != 0))
+        return -1;
+
+    // only RAID0 and RAID5 can start on fewer disks (and grow by reshape later)
+    if (members > DISKS || (type == RAID0 && members < 1) || (type == RAID5 && members < 2) ||
+        (type != RAID0 && type != RAID5 && members != DISKS))
+        return -1;
+
     raidmeta.type = type;
     raidmeta.read = readtable[type];
     raidmeta.write = writetable[type];
     raidmeta.isDestroyed = 0;
 
+    // rebuild of the previous array has no meaning for the new one - disk stays invalid
+    raidmeta.rebuilding = -1;
+
+    raidmeta.members = raidmeta.newmembers = members;
+    raidmeta.reshapepos = 0;
+    raidmeta.reshapebackup = -1;
+
+    // scrub of the previous array has no meaning for the new one either
+    raidmeta.scrubpos = 0;
+    raidmeta.scrubrate = 0;
+    raidmeta.scrubfound = 0;
+
+    // neither have checksums - blocks of the new array are not known yet
+    for (int i = VIRTIO_RAID_DISK_START; i <= VIRTIO_RAID_DISK_END; i++)
+        csumclear(i);
+
     switch (type) {
         case RAID0:
         {
@@ -193,6 +343,7 @@ setraidtype(int type)
                 raiddata->diskpair[i].writing = 0;
                 for (int j = 0; j < 2; j++)
                     raiddata->diskpair[i].reading[j] = 0;
+                memset(raiddata->diskpair[i].cluster_loaded, 0, sizeof(raiddata->diskpair[i].cluster_loaded));
             }
             break;
         }
@@ -207,6 +358,7 @@ setraidtype(int type)
                 raiddata->diskpair[i].writing = 0;
                 for (int j = 0; j < 2; j++)
                     raiddata->diskpair[i].reading[j] = 0;
+                memset(raiddata->diskpair[i].cluster_loaded, 0, sizeof(raiddata->diskpair[i].cluster_loaded));
             }
             break;
         }
@@ -264,12 +416,78 @@ setraidtype(int type)
 
             struct RAID5Data* raiddata = &raidmeta.data.raid5;
 
+            raiddata->layout = layout;
+
             initlock(&raiddata->repairlock, "repairlock_raid5");
             raiddata->repairing = 0;
             raiddata->writecount = 0;
 
             initsleeplock(&raiddata->clusterlock, "clusterlock");
 
+            for (int i=0; i<NELEM(raiddata->cluster_loaded); i++)
+                raiddata->cluster_loaded[i] = 0;
+
+            break;
+        }
+        case RAID6:
+        {
+            // P and Q need at least one data disk beside them
+            if (DISKS < 3)
+                return -1;
+
+            struct DiskInfo* diskinfo = raidmeta.diskinfo;
+
+            int israidable = 0;         // count invalid disks
+            for (int i = 0; i < DISKS; i++)
+            {
+                if (!diskinfo[i].valid)
+                    israidable++;
+            }
+
+            if (israidable > 2)
+                return -1;
+
+            struct RAID6Data* raiddata = &raidmeta.data.raid6;
+
+            initlock(&raiddata->repairlock, "repairlock_raid6");
+            raiddata->repairing = 0;
+            raiddata->writecount = 0;
+
+            initsleeplock(&raiddata->clusterlock, "clusterlock");
+
+            for (int i=0; i<NELEM(raiddata->cluster_loaded); i++)
+                raiddata->cluster_loaded[i] = 0;
+
+            break;
+        }
+        case RAID5D:
+        {
+            // group needs data and parity, and a tile needs a spare beside groups
+            if (DCL_GROUP < 2 || DCL_GROUP > DCL_COLUMNS)
+                return -1;
+
+            struct DiskInfo* diskinfo = raidmeta.diskinfo;
+
+            int israidable = 0;         // count invalid disks
+            for (int i = 0; i < DISKS; i++)
+            {
+                if (!diskinfo[i].valid)
+                    israidable++;
+            }
+
+            if (israidable > 1)
+                return -1;
+
+            struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+
+            initlock(&raiddata->repairlock, "repairlock_raid5d");
+            raiddata->repairing = 0;
+            raiddata->writecount = 0;
+            raiddata->spared = -1;
+            raiddata->sparedtiles = 0;
+
+            initsleeplock(&raiddata->clusterlock, "clusterlock");
+
             for (int i=0; i<NELEM(raiddata->cluster_loaded); i++)
                 raiddata->cluster_loaded[i] = 0;
 
@@ -277,11 +495,40 @@ setraidtype(int type)
         }
     }
 
+    // nothing of the new array is discarded yet - cluster locks are set up by now
+    discardreset();
+
     writeraidmeta();
 
     return 0;
 }
 
+// block read from disk i of pair does not match its checksum - take it from the other one,
+// and write it over the bad copy if that one matches
+// reading flag of disk i must be held, so there is no writer
+static uint64
+readothercopy(struct DiskPair* diskpair, int i, int pblkn, uchar* data)
+{
+    struct DiskInfo* bad = diskpair->disk[i];
+    struct DiskInfo* other = diskpair->disk[1 - i];
+
+    if (!blockvalid(other, pblkn))
+        return -1;
+
+    acquiresleep(&other->lock);
+    read_block(other->diskn, pblkn, data);
+    int ok = csumcheck(other->diskn, pblkn, data) == 0;
+    releasesleep(&other->lock);
+    if (!ok)
+        return -1;
+
+    acquiresleep(&bad->lock);
+    write_block(bad->diskn, pblkn, data);
+    releasesleep(&bad->lock);
+
+    return 0;
+}
+
 // multiple readers, single writer
 uint64
 readdiskpair(struct DiskPair* diskpair, int pblkn, uchar* data)
@@ -294,7 +541,7 @@ readdiskpair(struct DiskPair* diskpair, int pblkn, uchar* data)
     while (1)
     {
         // both invalid
-        if (diskpair->disk[0]->valid == 0 && diskpair->disk[1]->valid == 0)
+        if (!blockvalid(diskpair->disk[0], pblkn) && !blockvalid(diskpair->disk[1], pblkn))
         {
             release(&diskpair->mutex);
             return -1;
@@ -307,7 +554,7 @@ readdiskpair(struct DiskPair* diskpair, int pblkn, uchar* data)
         }
 
         for (int i = 0; i < 2; i++)
-            if (!diskpair->reading[i] && diskpair->disk[i]->valid) {
+            if (!diskpair->reading[i] && blockvalid(diskpair->disk[i], pblkn)) {
                 diskpair->reading[i] = 1;
                 release(&diskpair->mutex);
                 diskn = diskpair->disk[i]->diskn;
@@ -324,14 +571,44 @@ readdiskpair(struct DiskPair* diskpair, int pblkn, uchar* data)
     // acquire disk locks
     acquiresleep(&diskpair->disk[readfromPair]->lock);
     read_block(diskn, pblkn, data);
+    int bad = csumcheck(diskn, pblkn, data) < 0;
     releasesleep(&diskpair->disk[readfromPair]->lock);
 
+    uint64 ret = bad ? readothercopy(diskpair, readfromPair, pblkn, data) : 0;
+
     acquire(&diskpair->mutex);
     diskpair->reading[readfromPair] = 0;
     release(&diskpair->mutex);
     wakeup(&diskpair->mutex);       // arg is channel
 
-    return 0;
+    return ret;
+}
+
+// has cluster of pair been loaded - rows of a new array hold whatever the disks held before,
+// so the first write of a cluster copies it from the first disk to the second, and scrub compares only loaded ones
+int
+mirrorloaded(struct DiskPair* diskpair, uint64 clustern)
+{
+    return (diskpair->cluster_loaded[clustern / 8] >> (clustern % 8)) & 1;
+}
+
+// writing flag and both disk locks of pair must be held
+static void
+loadclustermirror(struct DiskPair* diskpair, uint64 clustern)
+{
+    trace(TR_CLUSTERLOAD, clustern);
+
+    // a disk being rebuilt, or repaired later, gets every row from its pair anyway
+    if (diskpair->disk[0]->valid && diskpair->disk[1]->valid)
+    {
+        // last cluster ends at checksum region
+        uint64 from = clustern * CLUSTER_SIZE;
+        uint64 to = from + CLUSTER_SIZE < diskblockn() ? from + CLUSTER_SIZE : diskblockn();
+        copyused(diskpair->disk[0]->diskn, diskpair->disk[1]->diskn, from, to);
+    }
+
+    diskpair->cluster_loaded[clustern / 8] |= 1 << (clustern % 8);
+    raidstat_event(STAT_CLUSTERLOAD);
 }
 
 uint64
@@ -341,7 +618,7 @@ writediskpair(struct DiskPair* diskpair, int pblkn, uchar* data)
 
     while (1)
     {
-        if (diskpair->disk[0]->valid == 0 && diskpair->disk[1]->valid == 0)
+        if (!blockvalid(diskpair->disk[0], pblkn) && !blockvalid(diskpair->disk[1], pblkn))
         {
             release(&diskpair->mutex);
             return -1;
@@ -368,14 +645,26 @@ writediskpair(struct DiskPair* diskpair, int pblkn, uchar* data)
     for (int i=0; i<2; i++)
         acquiresleep(&diskpair->disk[i]->lock);
 
+    uint64 clustern = pblkn / CLUSTER_SIZE;
+    int load = !mirrorloaded(diskpair, clustern);
+    if (load)
+        loadclustermirror(diskpair, clustern);
+
     // write in both parts of mirror if valid
     for (int i = 0; i < 2; i++)
-        if (diskpair->disk[i]->valid)
+        if (blockvalid(diskpair->disk[i], pblkn))
             write_block(diskpair->disk[i]->diskn, pblkn, (uchar*)data);
 
     for (int i=0; i<2; i++)
         releasesleep(&diskpair->disk[i]->lock);
 
+    // still the only writer of the pair, so the cluster is loaded once
+    if (load)
+    {
+        writeraidmeta();
+        trace(TR_CLUSTERDONE, clustern);
+    }
+
     acquire(&diskpair->mutex);
     diskpair->writing = 0;
     release(&diskpair->mutex);
@@ -384,6 +673,13 @@ writediskpair(struct DiskPair* diskpair, int pblkn, uchar* data)
     return 0;
 }
 
+// is block pblkn of disk usable - disk is valid, or the block is already rebuilt on hot spare in its place
+int
+blockvalid(struct DiskInfo* disk, uint64 pblkn)
+{
+    return disk->valid || (raidmeta.rebuilding == disk - raidmeta.diskinfo && pblkn < raidmeta.rebuildpos);
+}
+
 // stub for virtual function
 uint64
 readraid(int vblkn, uchar* data)
@@ -394,9 +690,24 @@ readraid(int vblkn, uchar* data)
         exit(0);
     }
 
-    if (raidmeta.read)
-        return (*raidmeta.read)(vblkn, data);
-    return -1;
+    raidactivity();
+
+    uint64 start = r_time();
+    uint64 ret = -1;
+    tracebegin(0);
+    raidiobegin();
+    if (discarded(vblkn))
+    {
+        // holds nothing - no need to ask the disks
+        memset(data, 0, BSIZE);
+        ret = 0;
+    }
+    else if (raidmeta.read)
+        ret = (*raidmeta.read)(vblkn, data);
+    raidioend();
+    traceend(ret == -1);
+    raidstat_array(0, ret == -1, start);
+    return ret;
 }
 
 // stub for virtual function
@@ -409,9 +720,19 @@ writeraid(int vblkn, uchar* data)
         exit(0);
     }
 
+    raidactivity();
+
+    uint64 start = r_time();
+    uint64 ret = -1;
+    tracebegin(1);
+    raidiobegin();
+    discardwrite(vblkn);
     if (raidmeta.write)
-        return (*raidmeta.write)(vblkn, data);
-    return -1;
+        ret = (*raidmeta.write)(vblkn, data);
+    raidioend();
+    traceend(ret == -1);
+    raidstat_array(1, ret == -1, start);
+    return ret;
 }
 
 uint64
@@ -431,6 +752,13 @@ raidfail(int diskn)         // cannot fail disk 0
 
     raidmeta.diskinfo[diskn].valid = 0;
 
+    // declustered layout has spare space on every disk - raidd rebuilds into it
+    if (raidmeta.type == RAID5D)
+        sparefailraid5d(diskn);
+
+    // take a hot spare in place of the disk, raidd rebuilds it in background
+    sparefail(diskn);
+
     writeraidmeta();
 
     return 0;
@@ -447,7 +775,7 @@ raidrepair(int diskn)
         exit(0);
     }
 
-    if (raidmeta.type < RAID0 || raidmeta.type > RAID5)
+    if (raidmeta.type < RAID0 || raidmeta.type > RAID5D)
         panic("raid not initialized\n");
 
     // diskn is [1-8]
@@ -456,8 +784,24 @@ raidrepair(int diskn)
     if (diskn < 0 || diskn >= DISKS)
         return -1;
 
-    if (raidmeta.diskinfo[diskn].valid)
+    // hot spare already took its place, and is rebuilt or being rebuilt
+    if (raidmeta.diskinfo[diskn].valid || raidmeta.rebuilding == diskn)
+    {
+        sparerepair(diskn);
+        return 0;
+    }
+
+    // content of disk comes from the other disks now - its checksums are stale
+    csumclear(raidmeta.diskinfo[diskn].diskn);
+
+    // disk not yet added to RAID0 or RAID5 holds nothing - reshape waits for it
+    if (diskn >= raidmeta.newmembers)
+    {
+        raidmeta.diskinfo[diskn].valid = 1;
+        sparerepair(diskn);
+        raiddwakeup();
         return 0;
+    }
 
     switch (raidmeta.type)
     {
@@ -492,19 +836,15 @@ raidrepair(int diskn)
             for (int i=0; i<2; i++)
                 acquiresleep(&diskpair->disk[i]->lock);
 
-            // WRITE EVERY BLOCK ON DISK FROM PAIR
-            for (int i = 0; i <= diskblockn(); i++)
-            {
-                uchar data[BSIZE];
-                read_block(pair->diskn, i, data);
-                write_block(raidmeta.diskinfo[diskn].diskn, i, data);
-            }
+            // WRITE EVERY BLOCK ON DISK FROM PAIR - discarded clusters hold nothing to copy
+            copyused(pair->diskn, raidmeta.diskinfo[diskn].diskn, 0, diskblockn());
+
+            // under the disk lock, so a hot spare does not take its place now (startrebuild)
+            raidmeta.diskinfo[diskn].valid = 1;
 
             // release disk locks
             for (int i=0; i<2; i++)
                 releasesleep(&diskpair->disk[i]->lock);
-
-            raidmeta.diskinfo[diskn].valid = 1;
             acquire(&diskpair->mutex);
             diskpair->writing = 0;
             release(&diskpair->mutex);
@@ -540,18 +880,14 @@ raidrepair(int diskn)
             for (int i=0; i<2; i++)
                 acquiresleep(&diskpair->disk[i]->lock);
 
-            for (int i = 0; i <= diskblockn(); i++)
-            {
-                uchar data[BSIZE];
-                read_block(pair->diskn, i, data);
-                write_block(raidmeta.diskinfo[diskn].diskn, i, data);
-            }
+            copyused(pair->diskn, raidmeta.diskinfo[diskn].diskn, 0, diskblockn());
+
+            // under the disk lock, so a hot spare does not take its place now (startrebuild)
+            raidmeta.diskinfo[diskn].valid = 1;
 
             // release disk locks
             for (int i=0; i<2; i++)
                 releasesleep(&diskpair->disk[i]->lock);
-
-            raidmeta.diskinfo[diskn].valid = 1;
             acquire(&diskpair->mutex);
             diskpair->writing = 0;
             release(&diskpair->mutex);
@@ -587,9 +923,9 @@ raidrepair(int diskn)
             for (int i = 0; i < DISKS; i++)
                 acquiresleep(&raidmeta.diskinfo[i].lock);
 
-            for (int b = 0; b <= diskblockn(); b++)
+            for (int b = 0; b < diskblockn(); b++)
             {
-                // if cluster has not been loaded before, no need for repair
+                // if cluster has not been loaded before, or was discarded since, no need for repair
                 uint64 clustern = b / CLUSTER_SIZE;
 
                 acquiresleep(&raiddata->clusterlock);
@@ -667,9 +1003,9 @@ raidrepair(int diskn)
             for (int i = 0; i < DISKS; i++)
                 acquiresleep(&raidmeta.diskinfo[i].lock);
 
-            for (int b = 0; b <= diskblockn(); b++)
+            for (int b = 0; b < diskblockn(); b++)
             {
-                // if cluster has not been loaded before, no need for repair
+                // if cluster has not been loaded before, or was discarded since, no need for repair
                 uint64 clustern = b / CLUSTER_SIZE;
 
                 acquiresleep(&raiddata->clusterlock);
@@ -686,7 +1022,7 @@ raidrepair(int diskn)
                     parity[i] = 0;
 
                 // repaired value is in parity - find it first
-                for (int i = 0; i < DISKS; i++)
+                for (int i = 0; i < raid5members(b); i++)
                 {
                     if (i != diskn)
                     {
@@ -719,11 +1055,62 @@ raidrepair(int diskn)
 
             break;
         }
+        case RAID6:
+        {
+            // two more invalid disks -> could not be fixed
+            int invalid = 0;
+            for (int i=0; i<DISKS; i++)
+                if (i != diskn && !raidmeta.diskinfo[i].valid)
+                    invalid++;
+            if (invalid > 1)
+                return -1;
+
+            struct RAID6Data* raiddata = &raidmeta.data.raid6;
+
+            // REPAIR - LOCK -ADD
+            acquire(&raiddata->repairlock);
+            raiddata->repairing++;
+            while (raiddata->writecount != 0 && raiddata->repairing != 0)
+            {
+                sleep(&raiddata->writecount, &raiddata->repairlock);
+            }
+            release(&raiddata->repairlock);
+
+            // acquire every disk lock
+            for (int i = 0; i < DISKS; i++)
+                acquiresleep(&raidmeta.diskinfo[i].lock);
+
+            repairraid6(diskn, 0, diskblockn());
+
+            raidmeta.diskinfo[diskn].valid = 1;
+
+            // release all disk locks
+            for (int i = 0; i < DISKS; i++)
+                releasesleep(&raidmeta.diskinfo[i].lock);
+
+            // REPAIR - LOCK -ADD
+            acquire(&raiddata->repairlock);
+            raiddata->repairing--;
+            if (raiddata->repairing == 0)
+            {
+                wakeup(&raiddata->repairing);
+            }
+            release(&raiddata->repairlock);
+
+            break;
+        }
+        case RAID5D:
+        {
+            if (repairraid5d(diskn) < 0)
+                return -1;
+            break;
+        }
 
         default:
         {}
     }
-    writeraidmeta();
+    sparerepair(diskn);
+    raiddwakeup();
     return 0;
 }
 
@@ -1,7 +1,11 @@
 #ifndef RAID_H
 #define RAID_H
 
-enum RAID_TYPE {RAID0, RAID1, RAID0_1, RAID4, RAID5};
+enum RAID_TYPE {RAID0, RAID1, RAID0_1, RAID4, RAID5, RAID6, RAID5D};
+
+// RAID5 parity layouts - where parity of a stripe is and in which order data follows it
+// right-symmetric is 0 and layout is the last field of RAID5Data, so arrays saved before layouts existed keep their rotation
+enum RAID5_LAYOUT {RIGHT_SYMMETRIC, RIGHT_ASYMMETRIC, LEFT_SYMMETRIC, LEFT_ASYMMETRIC};
 
 struct DiskInfo
 {
@@ -10,12 +14,16 @@ struct DiskInfo
     struct sleeplock lock;      // disk lock - mutex, first acquire raid locks, and then this disk lock
 };
 
+// number of blocks in one cluster
+#define CLUSTER_SIZE 128
+
 struct DiskPair
 {
     struct spinlock mutex;              // only for changing conditions
     struct DiskInfo* disk[2];           // 2 disks in pair
     uint8 writing;                      // condition
     uint8 reading[2];                   // condition
+    uint8 cluster_loaded[(DISK_SIZE_BYTES / BSIZE / CLUSTER_SIZE + 7) / 8];    // bit per cluster - both disks hold the same in its rows
 };
 
 struct RAID0Data
@@ -33,8 +41,13 @@ struct RAID0_1Data
     struct DiskPair diskpair[DISKS / 2];            // lock per pair
 };
 
-// number of blocks in one cluster
-#define CLUSTER_SIZE 128
+// per-block CRC32C - kept in CSUM_BLOCKS blocks between data and raidmeta at the end of every disk
+#define CSUMS_PER_BLOCK (BSIZE / sizeof(uint32))
+#define CSUM_BLOCKS ((DISK_SIZE_BYTES / BSIZE + CSUMS_PER_BLOCK - 1) / CSUMS_PER_BLOCK)
+
+// bitmap of discarded virtual blocks - kept in DISCARD_BLOCKS blocks between checksums and raidmeta of every disk
+#define DISCARD_BITS (DISK_SIZE_BYTES / BSIZE * DISKS)
+#define DISCARD_BLOCKS ((DISCARD_BITS + BSIZE * 8 - 1) / (BSIZE * 8))
 
 struct RAID4Data
 {
@@ -59,6 +72,42 @@ struct RAID5Data
     struct spinlock repairlock;
     int writecount;
     int repairing;
+
+    uint8 layout;                                                           // enum RAID5_LAYOUT, chosen at init - last, so old arrays read 0
+};
+
+// P + Q, survives two failed disks
+struct RAID6Data
+{
+    uint8 cluster_loaded[DISK_SIZE_BYTES / BSIZE / CLUSTER_SIZE];           // has been initialized flag for cluster (P and Q are set or not) -> for lazy loading
+    struct sleeplock clusterlock;                                           // lock for cluster_loaded array
+
+    struct spinlock repairlock;
+    int writecount;
+    int repairing;
+};
+
+// declustered RAID5 - groups of DCL_GROUP blocks (data + parity) spread pseudo-randomly over all disks,
+// every row of a tile keeps one block of distributed spare
+#ifndef DCL_GROUP
+#define DCL_GROUP (DISKS - 1 > 4 ? 4 : DISKS - 1)
+#endif
+#define DCL_COLUMNS (DISKS - 1)                                 // disks holding groups in a tile, the last one is spare
+#define DCL_TILE_DATA (DCL_COLUMNS * (DCL_GROUP - 1))           // data blocks in a tile
+#define DCL_TILES_PER_CLUSTER (CLUSTER_SIZE / DCL_GROUP)
+#define DCL_CLUSTERS ((DISK_SIZE_BYTES / BSIZE / DCL_GROUP + DCL_TILES_PER_CLUSTER - 1) / DCL_TILES_PER_CLUSTER)
+
+struct RAID5DData
+{
+    uint8 cluster_loaded[DCL_CLUSTERS];                                     // has been initialized flag for cluster of tiles -> for lazy loading
+    struct sleeplock clusterlock;                                           // lock for cluster_loaded array
+
+    struct spinlock repairlock;
+    int writecount;
+    int repairing;
+
+    int spared;                                                             // disk rebuilt into distributed spare, -1 if spare is free
+    uint64 sparedtiles;                                                     // tiles below this are already rebuilt into spare - raidd moves it
 };
 
 extern uint64 (*readtable[])(int, uchar*);
@@ -73,6 +122,26 @@ struct RAIDMeta
     struct DiskInfo diskinfo[DISKS + 1];
     int isDestroyed;
 
+    // hot spares
+    uint8 spare[SPARES + 1];            // disk numbers of unused hot spares, 0 when spare is taken
+    uint8 sparefailed[SPARES + 1];      // spare is a disk a hot spare took the place of, in slot sparefailed - 1 -
+                                        // it stands by again once that slot is repaired, 0 when it can be taken
+    int rebuilding;                     // disk being rebuilt on hot spare in background, -1 if none
+    uint64 rebuildpos;                  // blocks below this are already rebuilt on it
+
+    // online reshape - RAID0 and RAID5 grow onto more disks
+    uint8 members;                      // disks holding the array - first members of diskinfo
+    uint8 newmembers;                   // disks after reshape, same as members when there is none
+    uint64 reshapepos;                  // rows below this are already restriped over newmembers
+    int reshapebackup;                  // row whose blocks are saved in backup area, -1 if none
+
+    // background scrub
+    uint64 scrubpos;                    // rows below this are already checked in this pass
+    uint32 scrubrate;                   // rows checked per tick, 0 when no pass runs
+    uint32 scrubfound;                  // mismatches repaired in this pass
+
+    uint8 checksums;                    // blocks are checked against their CRC32C (raidcsum.c)
+
     union
     {
         struct RAID0Data raid0;
@@ -80,6 +149,8 @@ struct RAIDMeta
         struct RAID0_1Data raid0_1;
         struct RAID4Data raid4;
         struct RAID5Data raid5;
+        struct RAID6Data raid6;
+        struct RAID5DData raid5d;
     } data;
 
     // virtual "methods" for each type
@@ -11,6 +11,14 @@
 // global variable
 extern struct RAIDMeta raidmeta;
 
+// number of disks block is striped over - blocks already moved by reshape use the new number
+uint
+raid0members(int vblkn)
+{
+    if (vblkn < raidmeta.reshapepos * raidmeta.newmembers)
+        return raidmeta.newmembers;
+    return raidmeta.members;
+}
 
 uint64
 raid0read(int vblkn, uchar* data)
@@ -24,8 +32,9 @@ raid0read(int vblkn, uchar* data)
         return -1;
     }
 
-    uint diskn = vblkn % DISKS;
-    uint pblkn = vblkn / DISKS;
+    uint members = raid0members(vblkn);
+    uint diskn = vblkn % members;
+    uint pblkn = vblkn / members;
 
 
 //    struct RAID0Data* raiddata = &raidmeta.data.raid0;
@@ -37,8 +46,11 @@ raid0read(int vblkn, uchar* data)
 
     acquiresleep(&diskInfo->lock);
     read_block(diskInfo->diskn, pblkn, (uchar*)data);
+    int bad = csumcheck(diskInfo->diskn, pblkn, (uchar*)data) < 0;
     releasesleep(&diskInfo->lock);
-    return 0;
+
+    // no other copy to take it from
+    return bad ? -1 : 0;
 }
 
 uint64
@@ -50,8 +62,9 @@ raid0write(int vblkn, uchar* data)
     if (vblkn < 0 || vblkn >= raidblockn())
         return -1;
 
-    uint diskn = vblkn % DISKS;
-    uint pblkn = vblkn / DISKS;
+    uint members = raid0members(vblkn);
+    uint diskn = vblkn % members;
+    uint pblkn = vblkn / members;
 
 //    struct RAID0Data* raiddata = &raidmeta.data.raid0;
 
@@ -7,6 +7,8 @@
 #include "sleeplock.h"
 #include "defs.h"
 #include "raid.h"
+#include "raidstat.h"
+#include "trace.h"
 
 // global variable
 extern struct RAIDMeta raidmeta;
@@ -25,6 +27,8 @@ loadclusterraid4(uint64 clustern)
     if (clustern < 0 || clustern >= DISK_SIZE_BYTES / BSIZE / CLUSTER_SIZE)
         panic("Wrong cluster number in loading...");
 
+    trace(TR_CLUSTERLOAD, clustern);
+
     uchar* page = (uchar*) kalloc();
     uchar* data = page;
     uchar* parity = page + BSIZE;
@@ -35,8 +39,9 @@ loadclusterraid4(uint64 clustern)
     for (int i = 0; i < DISKS; i++)
         acquiresleep(&raidmeta.diskinfo[i].lock);
 
+    // last cluster ends at checksum region
     uint64 startblock = clustern * CLUSTER_SIZE;
-    for (int i=startblock; i<startblock + CLUSTER_SIZE; i++)
+    for (int i=startblock; i<startblock + CLUSTER_SIZE && i<diskblockn(); i++)
     {
         for (int i=0; i<BSIZE; i++)
             parity[i] = 0;
@@ -45,7 +50,7 @@ loadclusterraid4(uint64 clustern)
 
         for (int diskn=0; diskn<DISKS-1; diskn++)
         {
-            if (diskinfo[diskn].valid)
+            if (blockvalid(&diskinfo[diskn], i))
             {
                 read_block(diskinfo[diskn].diskn, i, data);
                 for (int i=0; i<BSIZE; i++)
@@ -53,19 +58,21 @@ loadclusterraid4(uint64 clustern)
             }
         }
 
-        if (diskinfo[DISKS - 1].valid)
+        if (blockvalid(&diskinfo[DISKS - 1], i))
         {
-            write_block(DISKS, i, parity);
+            write_block(diskinfo[DISKS - 1].diskn, i, parity);
         }
     }
 
     raiddata->cluster_loaded[clustern] = 1;
+    raidstat_event(STAT_CLUSTERLOAD);
 
     // release all disk locks
     for (int i = 0; i < DISKS; i++)
         releasesleep(&raidmeta.diskinfo[i].lock);
 
     writeraidmeta();
+    trace(TR_CLUSTERDONE, clustern);
 
     kfree(page);
     return 0;
@@ -77,6 +84,8 @@ loadclusterraid4(uint64 clustern)
 int
 readinvalidraid4(int diskn, int blockn, uchar* data)
 {
+    raidstat_event(STAT_DEGRADED);
+
     uchar* newpg = (uchar*)kalloc();
     uchar* buff = newpg;
     uchar* parity = newpg + BSIZE;
@@ -103,6 +112,31 @@ readinvalidraid4(int diskn, int blockn, uchar* data)
     return 0;
 }
 
+// block read from disk does not match its checksum - rebuild it from the rest of the stripe,
+// and write it back if the result matches
+static uint64
+fixblockraid4(int diskn, int blockn, uchar* data)
+{
+    for (int i = 0; i < DISKS; i++)
+        if (i != diskn && !blockvalid(&raidmeta.diskinfo[i], blockn))
+            return -1;
+
+    // acquire every disk lock
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&raidmeta.diskinfo[i].lock);
+
+    readinvalidraid4(diskn, blockn, data);
+    int ok = csumcheck(raidmeta.diskinfo[diskn].diskn, blockn, data) == 0;
+    if (ok)
+        write_block(raidmeta.diskinfo[diskn].diskn, blockn, data);
+
+    // release all disk locks
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&raidmeta.diskinfo[i].lock);
+
+    return ok ? 0 : -1;
+}
+
 uint64
 raid4read(int vblkn, uchar* data)
 {
@@ -118,11 +152,11 @@ raid4read(int vblkn, uchar* data)
 //    struct RAID4Data* raiddata = &raidmeta.data.raid4;
     struct DiskInfo* diskinfo = raidmeta.diskinfo;
 
-    if (!diskinfo[diskn].valid)     // if disk is not valid, try to repair data from it
+    if (!blockvalid(&diskinfo[diskn], pblkn))     // if disk is not valid, try to repair data from it
     {
         // are there more invalid disks
         for (int i = 0; i < DISKS; i++)
-            if (i != diskn && !diskinfo[i].valid)       // there are more invalid disks, so it cannot be repaired
+            if (i != diskn && !blockvalid(&diskinfo[i], pblkn))       // there are more invalid disks, so it cannot be repaired
                 return -1;
 
         // acquire every disk lock
@@ -138,8 +172,12 @@ raid4read(int vblkn, uchar* data)
     else
     {
         acquiresleep(&raidmeta.diskinfo[diskn].lock);
-        read_block(diskn+1, pblkn, data);
+        read_block(diskinfo[diskn].diskn, pblkn, data);
+        int bad = csumcheck(diskinfo[diskn].diskn, pblkn, data) < 0;
         releasesleep(&raidmeta.diskinfo[diskn].lock);
+
+        if (bad)
+            return fixblockraid4(diskn, pblkn, data);
     }
 
     return 0;
@@ -160,11 +198,11 @@ raid4write(int vblkn, uchar* data)
     struct DiskInfo* diskinfo = raidmeta.diskinfo;
 
     // are there 2 or more invalid disks
-    if (!diskinfo[diskn].valid)
+    if (!blockvalid(&diskinfo[diskn], pblkn))
     {
         for (int i = 0; i < DISKS; i++)
         {
-            if (i != diskn && !diskinfo[i].valid)       // there are more invalid disks, so it cannot be repaired
+            if (i != diskn && !blockvalid(&diskinfo[i], pblkn))       // there are more invalid disks, so it cannot be repaired
                 return -1;
         }
     }
@@ -181,8 +219,10 @@ raid4write(int vblkn, uchar* data)
     acquire(&raiddata->repairlock);
     while (raiddata->repairing)
     {
+        trace(TR_GATEWAIT, 0);
         sleep(&raiddata->repairing, &raiddata->repairlock);
     }
+    trace(TR_GATEPASS, 0);
     raiddata->writecount++;
     release(&raiddata->repairlock);
 
@@ -193,28 +233,31 @@ raid4write(int vblkn, uchar* data)
     }
     releasesleep(&raiddata->clusterlock);
 
-    if (!diskinfo[diskn].valid)
+    if (!blockvalid(&diskinfo[diskn], pblkn))
     {
         // acquire every disk lock
         for (int i = 0; i < DISKS; i++)
             acquiresleep(&raidmeta.diskinfo[i].lock);
 
         readinvalidraid4(diskn, pblkn, prevdata);
-        read_block(DISKS, pblkn, parity);       // prob not needed
+        read_block(diskinfo[DISKS - 1].diskn, pblkn, parity);       // prob not needed
+        raidstat_event(STAT_PARITYREAD);
 
+        trace(TR_PARITY, 0);
         for (int i = 0; i < BSIZE; i++)
             parity[i] ^= prevdata[i] ^ data[i];
+        trace(TR_PARITYDONE, 0);
 
-        write_block(DISKS, pblkn, parity);
+        write_block(diskinfo[DISKS - 1].diskn, pblkn, parity);
 
         // release all disk locks
         for (int i = 0; i < DISKS; i++)
             releasesleep(&raidmeta.diskinfo[i].lock);
     }
-    else if (!diskinfo[DISKS-1].valid)
+    else if (!blockvalid(&diskinfo[DISKS - 1], pblkn))
     {
         acquiresleep(&raidmeta.diskinfo[diskn].lock);
-        write_block(diskn + 1, pblkn, data);
+        write_block(diskinfo[diskn].diskn, pblkn, data);
         releasesleep(&raidmeta.diskinfo[diskn].lock);
     }
     else
@@ -222,15 +265,18 @@ raid4write(int vblkn, uchar* data)
         acquiresleep(&raidmeta.diskinfo[diskn].lock);
         acquiresleep(&raidmeta.diskinfo[DISKS - 1].lock);
 
-        read_block(diskn + 1, pblkn, prevdata);
-        read_block(DISKS, pblkn, parity);
+        read_block(diskinfo[diskn].diskn, pblkn, prevdata);
+        read_block(diskinfo[DISKS - 1].diskn, pblkn, parity);
+        raidstat_event(STAT_PARITYREAD);
 
+        trace(TR_PARITY, 0);
         for (int i = 0; i < BSIZE; i++)
             parity[i] ^= prevdata[i] ^ data[i];
+        trace(TR_PARITYDONE, 0);
 
-        write_block(diskn + 1, pblkn, data);
+        write_block(diskinfo[diskn].diskn, pblkn, data);
         // write new parity
-        write_block(DISKS, pblkn, parity);
+        write_block(diskinfo[DISKS - 1].diskn, pblkn, parity);
 
         releasesleep(&raidmeta.diskinfo[DISKS - 1].lock);
         releasesleep(&raidmeta.diskinfo[diskn].lock);
@@ -248,4 +294,29 @@ raid4write(int vblkn, uchar* data)
     release(&raiddata->repairlock);
 
     return 0;
-}
\ No newline at end of file
+}
+// check parity of row against its data and write it again if it differs, or rebuild a block that
+// fails its checksum (scrubxor) - returns 1 if it wrote one
+// writers must be stopped and all disk locks held when called
+int
+scrubraid4(uint64 row)
+{
+    struct RAID4Data* raiddata = &raidmeta.data.raid4;
+
+    // parity of cluster not loaded yet was never set up
+    acquiresleep(&raiddata->clusterlock);
+    int loaded = raiddata->cluster_loaded[row / CLUSTER_SIZE];
+    releasesleep(&raiddata->clusterlock);
+    if (!loaded)
+        return 0;
+
+    int diskn[DISKS];
+    uint64 blockno[DISKS];
+    for (int i = 0; i < DISKS; i++)
+    {
+        diskn[i] = raidmeta.diskinfo[i].diskn;
+        blockno[i] = row;
+    }
+
+    return scrubxor(diskn, blockno, DISKS, DISKS - 1);
+}
@@ -7,10 +7,64 @@
 #include "sleeplock.h"
 #include "defs.h"
 #include "raid.h"
+#include "raidstat.h"
+#include "trace.h"
 
 // global variable
 extern struct RAIDMeta raidmeta;
 
+// number of disks stripe is spread over - stripes already moved by reshape use the new number
+uint64
+raid5members(uint64 stripe)
+{
+    if (stripe < raidmeta.reshapepos)
+        return raidmeta.newmembers;
+    return raidmeta.members;
+}
+
+// stripe holding virtual block
+uint64
+raid5stripe(int vblkn)
+{
+    uint64 moved = raidmeta.reshapepos * (raidmeta.newmembers - 1);
+    if (vblkn < moved)
+        return vblkn / (raidmeta.newmembers - 1);
+    return vblkn / (raidmeta.members - 1);
+}
+
+// disk holding parity of stripe over members disks
+// left layouts rotate parity from the last disk down, right layouts from the first disk up
+uint64
+raid5paritydisk(uint64 stripe, uint64 members)
+{
+    switch (raidmeta.data.raid5.layout)
+    {
+        case LEFT_SYMMETRIC:
+        case LEFT_ASYMMETRIC:
+            return members - 1 - stripe % members;
+        default:
+            return stripe % members;
+    }
+}
+
+// disk holding data block on position stripepos [0, members - 2] of stripe
+// symmetric layouts start data right after parity (wrapping around), so consecutive blocks visit every disk
+// asymmetric layouts keep data in disk order and only skip the parity disk
+uint64
+raid5datadisk(uint64 stripe, uint64 stripepos, uint64 members)
+{
+    uint64 paritydiskn = raid5paritydisk(stripe, members);
+
+    switch (raidmeta.data.raid5.layout)
+    {
+        case RIGHT_ASYMMETRIC:
+        case LEFT_ASYMMETRIC:
+            return stripepos < paritydiskn ? stripepos : stripepos + 1;
+        default:
+            return (paritydiskn + 1 + stripepos) % members;
+    }
+}
+
 // cluster lock must be held when calling
 int
 loadclusterraid5(uint64 clustern)
@@ -25,6 +79,8 @@ loadclusterraid5(uint64 clustern)
     if (clustern < 0 || clustern >= DISK_SIZE_BYTES / BSIZE / CLUSTER_SIZE)
         panic("Wrong cluster number in loading...");
 
+    trace(TR_CLUSTERLOAD, clustern);
+
     uchar* page = (uchar*) kalloc();
     uchar* data = page;
     uchar* parity = page + BSIZE;
@@ -35,19 +91,21 @@ loadclusterraid5(uint64 clustern)
     for (int i = 0; i < DISKS; i++)
         acquiresleep(&raidmeta.diskinfo[i].lock);
 
+    // last cluster ends at checksum region
     uint64 startblock = clustern * CLUSTER_SIZE;
-    for (int i=startblock; i<startblock + CLUSTER_SIZE; i++)
+    for (int i=startblock; i<startblock + CLUSTER_SIZE && i<diskblockn(); i++)
     {
         for (int i=0; i<BSIZE; i++)
             parity[i] = 0;
 
-        uint paritydiskn = i % DISKS;
+        uint64 members = raid5members(i);
+        uint paritydiskn = raid5paritydisk(i, members);
 
         struct DiskInfo* diskinfo = raidmeta.diskinfo;
 
-        for (int diskn=0; diskn<DISKS; diskn++)
+        for (int diskn=0; diskn<members; diskn++)
         {
-            if (diskinfo[diskn].valid && diskn != paritydiskn)
+            if (blockvalid(&diskinfo[diskn], i) && diskn != paritydiskn)
             {
                 read_block(diskinfo[diskn].diskn, i, data);
                 for (int i=0; i<BSIZE; i++)
@@ -55,19 +113,21 @@ loadclusterraid5(uint64 clustern)
             }
         }
 
-        if (diskinfo[paritydiskn].valid)
+        if (blockvalid(&diskinfo[paritydiskn], i))
         {
             write_block(diskinfo[paritydiskn].diskn, i, parity);
         }
     }
 
     raiddata->cluster_loaded[clustern] = 1;
+    raidstat_event(STAT_CLUSTERLOAD);
 
     // release all disk locks
     for (int i = 0; i < DISKS; i++)
         releasesleep(&raidmeta.diskinfo[i].lock);
 
     writeraidmeta();
+    trace(TR_CLUSTERDONE, clustern);
 
     kfree(page);
     return 0;
@@ -79,6 +139,8 @@ loadclusterraid5(uint64 clustern)
 int
 readinvalidraid5(int diskn, int blockn, uchar* data)
 {
+    raidstat_event(STAT_DEGRADED);
+
     uchar* newpg = (uchar*)kalloc();
     uchar* buff = newpg;
     uchar* parity = newpg + BSIZE;
@@ -88,7 +150,8 @@ readinvalidraid5(int diskn, int blockn, uchar* data)
 
 //    struct RAID4Data* raiddata = &raidmeta.data.raid4;
 
-    for (int i = 0; i < DISKS; i++)
+    uint64 members = raid5members(blockn);
+    for (int i = 0; i < members; i++)
     {
         if (i != diskn)
         {
@@ -105,6 +168,31 @@ readinvalidraid5(int diskn, int blockn, uchar* data)
     return 0;
 }
 
+// block read from disk does not match its checksum - rebuild it from the rest of the stripe,
+// and write it back if the result matches
+static uint64
+fixblockraid5(int diskn, uint64 stripe, uchar* data)
+{
+    for (int i = 0; i < raid5members(stripe); i++)
+        if (i != diskn && !blockvalid(&raidmeta.diskinfo[i], stripe))
+            return -1;
+
+    // acquire every disk lock
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&raidmeta.diskinfo[i].lock);
+
+    readinvalidraid5(diskn, stripe, data);
+    int ok = csumcheck(raidmeta.diskinfo[diskn].diskn, stripe, data) == 0;
+    if (ok)
+        write_block(raidmeta.diskinfo[diskn].diskn, stripe, data);
+
+    // release all disk locks
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&raidmeta.diskinfo[i].lock);
+
+    return ok ? 0 : -1;
+}
+
 uint64
 raid5read(int vblkn, uchar* data)
 {
@@ -114,18 +202,18 @@ raid5read(int vblkn, uchar* data)
     if (vblkn < 0 || vblkn >= raidblockn())
         return -1;
 
-    uint64 stripe = vblkn / (DISKS - 1);
-    uint64 paritydiskn = stripe % DISKS;
-    uint64 stripepos = vblkn % (DISKS - 1);
-    uint64 diskn = (paritydiskn + 1 + stripepos) % DISKS;
+    uint64 stripe = raid5stripe(vblkn);
+    uint64 members = raid5members(stripe);
+    uint64 stripepos = vblkn % (members - 1);
+    uint64 diskn = raid5datadisk(stripe, stripepos, members);
 
     struct DiskInfo* diskinfo = raidmeta.diskinfo;
 
-    if (!diskinfo[diskn].valid)     // if disk is not valid, try to repair data from it
+    if (!blockvalid(&diskinfo[diskn], stripe))     // if disk is not valid, try to repair data from it
     {
         // are there more invalid disks
-        for (int i = 0; i < DISKS; i++)
-            if (i != diskn && !diskinfo[i].valid)       // there are more invalid disks, so it cannot be repaired
+        for (int i = 0; i < members; i++)
+            if (i != diskn && !blockvalid(&diskinfo[i], stripe))       // there are more invalid disks, so it cannot be repaired
                 return -1;
 
         // acquire every disk lock
@@ -141,8 +229,12 @@ raid5read(int vblkn, uchar* data)
     else
     {
         acquiresleep(&raidmeta.diskinfo[diskn].lock);
-        read_block(diskn+1, stripe, data);
+        read_block(diskinfo[diskn].diskn, stripe, data);
+        int bad = csumcheck(diskinfo[diskn].diskn, stripe, data) < 0;
         releasesleep(&raidmeta.diskinfo[diskn].lock);
+
+        if (bad)
+            return fixblockraid5(diskn, stripe, data);
     }
 
     return 0;
@@ -157,19 +249,20 @@ raid5write(int vblkn, uchar* data)
     if (vblkn < 0 || vblkn >= raidblockn())
         return -1;
 
-    uint64 stripe = vblkn / (DISKS - 1);
-    uint64 paritydiskn = stripe % DISKS;
-    uint64 stripepos = vblkn % (DISKS - 1);
-    uint64 diskn = (paritydiskn + 1 + stripepos) % DISKS;
+    uint64 stripe = raid5stripe(vblkn);
+    uint64 members = raid5members(stripe);
+    uint64 paritydiskn = raid5paritydisk(stripe, members);
+    uint64 stripepos = vblkn % (members - 1);
+    uint64 diskn = raid5datadisk(stripe, stripepos, members);
 
     struct DiskInfo* diskinfo = raidmeta.diskinfo;
 
     // are there 2 or more invalid disks
-    if (!diskinfo[diskn].valid)
+    if (!blockvalid(&diskinfo[diskn], stripe))
     {
-        for (int i = 0; i < DISKS; i++)
+        for (int i = 0; i < members; i++)
         {
-            if (i != diskn && !diskinfo[i].valid)       // there are more invalid disks, so it cannot be repaired
+            if (i != diskn && !blockvalid(&diskinfo[i], stripe))       // there are more invalid disks, so it cannot be repaired
                 return -1;
         }
     }
@@ -186,8 +279,10 @@ raid5write(int vblkn, uchar* data)
     acquire(&raiddata->repairlock);
     while (raiddata->repairing)
     {
+        trace(TR_GATEWAIT, 0);
         sleep(&raiddata->repairing, &raiddata->repairlock);
     }
+    trace(TR_GATEPASS, 0);
     raiddata->writecount++;
     release(&raiddata->repairlock);
 
@@ -198,7 +293,7 @@ raid5write(int vblkn, uchar* data)
     }
     releasesleep(&raiddata->clusterlock);
 
-    if (!diskinfo[diskn].valid)
+    if (!blockvalid(&diskinfo[diskn], stripe))
     {
         // acquire every disk lock
         for (int i = 0; i < DISKS; i++)
@@ -206,9 +301,12 @@ raid5write(int vblkn, uchar* data)
 
         readinvalidraid5(diskn, stripe, prevdata);
         read_block(diskinfo[paritydiskn].diskn, stripe, parity);       // prob not needed
+        raidstat_event(STAT_PARITYREAD);
 
+        trace(TR_PARITY, 0);
         for (int i = 0; i < BSIZE; i++)
             parity[i] ^= prevdata[i] ^ data[i];
+        trace(TR_PARITYDONE, 0);
 
         write_block(diskinfo[paritydiskn].diskn, stripe, parity);
 
@@ -216,10 +314,10 @@ raid5write(int vblkn, uchar* data)
         for (int i = 0; i < DISKS; i++)
             releasesleep(&raidmeta.diskinfo[i].lock);
     }
-    else if (!diskinfo[paritydiskn].valid)
+    else if (!blockvalid(&diskinfo[paritydiskn], stripe))
     {
         acquiresleep(&raidmeta.diskinfo[diskn].lock);
-        write_block(diskn + 1, stripe, data);
+        write_block(diskinfo[diskn].diskn, stripe, data);
         releasesleep(&raidmeta.diskinfo[diskn].lock);
     }
     else
@@ -236,13 +334,16 @@ raid5write(int vblkn, uchar* data)
             acquiresleep(&raidmeta.diskinfo[diskn].lock);
         }
 
-        read_block(diskn + 1, stripe, prevdata);
+        read_block(diskinfo[diskn].diskn, stripe, prevdata);
         read_block(diskinfo[paritydiskn].diskn, stripe, parity);
+        raidstat_event(STAT_PARITYREAD);
 
+        trace(TR_PARITY, 0);
         for (int i = 0; i < BSIZE; i++)
             parity[i] ^= prevdata[i] ^ data[i];
+        trace(TR_PARITYDONE, 0);
 
-        write_block(diskn + 1, stripe, data);
+        write_block(diskinfo[diskn].diskn, stripe, data);
         // write new parity
         write_block(diskinfo[paritydiskn].diskn, stripe, parity);
 
@@ -270,4 +371,31 @@ raid5write(int vblkn, uchar* data)
     release(&raiddata->repairlock);
 
     return 0;
-}
\ No newline at end of file
+}
+
+// check parity of stripe against its data and write it again if it differs, or rebuild a block that
+// fails its checksum (scrubxor) - returns 1 if it wrote one
+// writers must be stopped and all disk locks held when called
+int
+scrubraid5(uint64 stripe)
+{
+    struct RAID5Data* raiddata = &raidmeta.data.raid5;
+
+    // parity of cluster not loaded yet was never set up
+    acquiresleep(&raiddata->clusterlock);
+    int loaded = raiddata->cluster_loaded[stripe / CLUSTER_SIZE];
+    releasesleep(&raiddata->clusterlock);
+    if (!loaded)
+        return 0;
+
+    uint64 members = raid5members(stripe);
+    int diskn[DISKS];
+    uint64 blockno[DISKS];
+    for (int i = 0; i < members; i++)
+    {
+        diskn[i] = raidmeta.diskinfo[i].diskn;
+        blockno[i] = stripe;
+    }
+
+    return scrubxor(diskn, blockno, members, raid5paritydisk(stripe, members));
+}
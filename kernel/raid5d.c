@@ -0,0 +1,708 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "raid.h"
+#include "raidstat.h"
+#include "trace.h"
+
+// global variable
+extern struct RAIDMeta raidmeta;
+
+// Declustered RAID5.
+// Disk is cut in tiles of DCL_GROUP rows. Every tile shuffles disks with a pseudo-random permutation:
+// first DCL_COLUMNS positions are columns, the last one is the distributed spare of that tile.
+// Group j of tile has one block in every row m of tile, on column (j + m) % DCL_COLUMNS,
+// so groups are DCL_GROUP blocks wide (one of them parity) and never use a disk twice.
+// Failed disk is rebuilt into spares, which are on different disks in different tiles - raidd does it
+// in background, a cluster of tiles at a time, and tiles below the watermark are read from the spare.
+
+// number of tiles on disk - last block is for raidmeta
+uint64
+tilesraid5d(void)
+{
+    return diskblockn() / DCL_GROUP;
+}
+
+// permutation of disks for tile - perm[position] = disk
+// if some disk is spared and the tile is already rebuilt, it swaps places with spare of tile,
+// so its blocks are read from spare
+static void
+tilepermraid5d(uint64 tile, uint8* perm, int usespared)
+{
+    for (int i = 0; i < DISKS; i++)
+        perm[i] = i;
+
+    // xorshift seeded by tile number, Fisher-Yates shuffle
+    uint64 x = tile * 0x9e3779b97f4a7c15ULL + 0x2545f4914f6cdd1dULL;
+    for (int i = DISKS - 1; i > 0; i--)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        int j = x % (i + 1);
+        uint8 tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+
+    int spared = raidmeta.data.raid5d.spared;
+    if (usespared && spared >= 0 && tile < raidmeta.data.raid5d.sparedtiles)
+    {
+        for (int i = 0; i < DCL_COLUMNS; i++)
+            if (perm[i] == spared)
+            {
+                perm[i] = perm[DCL_COLUMNS];
+                perm[DCL_COLUMNS] = spared;
+                break;
+            }
+    }
+}
+
+// disk of member m (row of tile) of group j
+static int
+memberdiskraid5d(uint8* perm, int j, int m)
+{
+    return perm[(j + m) % DCL_COLUMNS];
+}
+
+// parity is on a different member for every group of tile
+static int
+paritymemberraid5d(int j)
+{
+    return j % DCL_GROUP;
+}
+
+// position of disk in permutation
+static int
+positionraid5d(uint8* perm, int diskn)
+{
+    for (int i = 0; i < DISKS; i++)
+        if (perm[i] == diskn)
+            return i;
+    panic("raid5d position");
+}
+
+// are all members of group j valid, except member m
+static int
+groupvalidraid5d(uint8* perm, int j, int m)
+{
+    for (int i = 0; i < DCL_GROUP; i++)
+        if (i != m && !raidmeta.diskinfo[memberdiskraid5d(perm, j, i)].valid)
+            return 0;
+    return 1;
+}
+
+// xor of all members of group j except member m - content of member m
+// buff is scratch block
+// disk locks of group must be held when called
+static void
+reconstructraid5d(uint64 tile, uint8* perm, int j, int m, uchar* data, uchar* buff)
+{
+    for (int i = 0; i < BSIZE; i++)
+        data[i] = 0;
+
+    for (int i = 0; i < DCL_GROUP; i++)
+    {
+        if (i == m)
+            continue;
+        read_block(raidmeta.diskinfo[memberdiskraid5d(perm, j, i)].diskn, tile * DCL_GROUP + i, buff);
+        for (int k = 0; k < BSIZE; k++)
+            data[k] ^= buff[k];
+    }
+}
+
+static int
+tileloadedraid5d(uint64 tile)
+{
+    struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+
+    acquiresleep(&raiddata->clusterlock);
+    int loaded = raiddata->cluster_loaded[tile / DCL_TILES_PER_CLUSTER];
+    releasesleep(&raiddata->clusterlock);
+
+    return loaded;
+}
+
+// cluster lock must be held when calling
+int
+loadclusterraid5d(uint64 clustern)
+{
+    if (raidmeta.type != RAID5D)
+        panic("wrong raid function called\n");
+
+    if (clustern < 0 || clustern >= DCL_CLUSTERS)
+        panic("Wrong cluster number in loading...");
+
+    trace(TR_CLUSTERLOAD, clustern);
+
+    uchar* page = (uchar*) kalloc();
+    uchar* data = page;
+    uchar* parity = page + BSIZE;
+
+    struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+    struct DiskInfo* diskinfo = raidmeta.diskinfo;
+
+    // acquire all disk locks
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&raidmeta.diskinfo[i].lock);
+
+    uint64 starttile = clustern * DCL_TILES_PER_CLUSTER;
+    for (uint64 tile = starttile; tile < starttile + DCL_TILES_PER_CLUSTER && tile < tilesraid5d(); tile++)
+    {
+        uint8 perm[DISKS];
+        tilepermraid5d(tile, perm, 1);
+
+        for (int j = 0; j < DCL_COLUMNS; j++)
+        {
+            for (int i = 0; i < BSIZE; i++)
+                parity[i] = 0;
+
+            int pm = paritymemberraid5d(j);
+            for (int m = 0; m < DCL_GROUP; m++)
+            {
+                int diskn = memberdiskraid5d(perm, j, m);
+                if (m != pm && diskinfo[diskn].valid)
+                {
+                    read_block(diskinfo[diskn].diskn, tile * DCL_GROUP + m, data);
+                    for (int i = 0; i < BSIZE; i++)
+                        parity[i] ^= data[i];
+                }
+            }
+
+            int paritydiskn = memberdiskraid5d(perm, j, pm);
+            if (diskinfo[paritydiskn].valid)
+                write_block(diskinfo[paritydiskn].diskn, tile * DCL_GROUP + pm, parity);
+        }
+    }
+
+    raiddata->cluster_loaded[clustern] = 1;
+    raidstat_event(STAT_CLUSTERLOAD);
+
+    // release all disk locks
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&raidmeta.diskinfo[i].lock);
+
+    writeraidmeta();
+    trace(TR_CLUSTERDONE, clustern);
+
+    kfree(page);
+    return 0;
+}
+
+// place of virtual block: tile, group, member of group and member holding parity
+static void
+locateraid5d(int vblkn, uint64* tile, int* j, int* m, int* pm)
+{
+    *tile = vblkn / DCL_TILE_DATA;
+    int r = vblkn % DCL_TILE_DATA;
+    *j = r / (DCL_GROUP - 1);
+    int k = r % (DCL_GROUP - 1);
+    *pm = paritymemberraid5d(*j);
+    *m = k < *pm ? k : k + 1;
+}
+
+// block of member m of group j read from disk does not match its checksum - rebuild it from
+// the rest of the group, and write it back if the result matches
+static uint64
+fixblockraid5d(uint64 tile, int j, int m, uchar* data)
+{
+    uchar* page = (uchar*) kalloc();
+
+    // acquire every disk lock
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&raidmeta.diskinfo[i].lock);
+
+    // permutation is taken under the locks, the spare could move since the read
+    uint8 perm[DISKS];
+    tilepermraid5d(tile, perm, 1);
+    int diskn = raidmeta.diskinfo[memberdiskraid5d(perm, j, m)].diskn;
+
+    int ok = groupvalidraid5d(perm, j, m);
+    if (ok)
+    {
+        reconstructraid5d(tile, perm, j, m, page, page + BSIZE);
+        ok = csumcheck(diskn, tile * DCL_GROUP + m, page) == 0;
+    }
+    if (ok)
+    {
+        write_block(diskn, tile * DCL_GROUP + m, page);
+        memmove(data, page, BSIZE);
+    }
+
+    // release all disk locks
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&raidmeta.diskinfo[i].lock);
+
+    kfree(page);
+    return ok ? 0 : -1;
+}
+
+uint64
+raid5dread(int vblkn, uchar* data)
+{
+    if (raidmeta.type != RAID5D)
+        panic("wrong raid function called\n");
+
+    if (vblkn < 0 || vblkn >= raidblockn())
+        return -1;
+
+    uint64 tile;
+    int j, m, pm;
+    locateraid5d(vblkn, &tile, &j, &m, &pm);
+
+    struct DiskInfo* diskinfo = raidmeta.diskinfo;
+
+    // spare watermark moves only with every disk lock held (sparestepraid5d), so the permutation
+    // is taken again under the locks - if the member moved meanwhile, it starts over
+    for (;;)
+    {
+        uint8 perm[DISKS];
+        tilepermraid5d(tile, perm, 1);
+        int diskn = memberdiskraid5d(perm, j, m);
+
+        if (diskinfo[diskn].valid)
+        {
+            acquiresleep(&diskinfo[diskn].lock);
+            tilepermraid5d(tile, perm, 1);
+            if (memberdiskraid5d(perm, j, m) != diskn)
+            {
+                releasesleep(&diskinfo[diskn].lock);
+                continue;
+            }
+
+            read_block(diskinfo[diskn].diskn, tile * DCL_GROUP + m, data);
+            int bad = csumcheck(diskinfo[diskn].diskn, tile * DCL_GROUP + m, data) < 0;
+            releasesleep(&diskinfo[diskn].lock);
+
+            return bad ? fixblockraid5d(tile, j, m, data) : 0;
+        }
+
+        uchar* page = (uchar*) kalloc();
+
+        // acquire every disk lock
+        for (int i = 0; i < DISKS; i++)
+            acquiresleep(&diskinfo[i].lock);
+
+        // only the rest of the group is needed, other disks may be invalid
+        tilepermraid5d(tile, perm, 1);
+        int moved = memberdiskraid5d(perm, j, m) != diskn;
+        int ok = !moved && groupvalidraid5d(perm, j, m);
+        if (ok)
+        {
+            reconstructraid5d(tile, perm, j, m, page, page + BSIZE);
+            raidstat_event(STAT_DEGRADED);
+        }
+
+        // release all disk locks
+        for (int i = 0; i < DISKS; i++)
+            releasesleep(&diskinfo[i].lock);
+
+        if (ok)
+            memmove(data, page, BSIZE);
+        kfree(page);
+
+        if (!moved)
+            return ok ? 0 : -1;
+    }
+}
+
+uint64
+raid5dwrite(int vblkn, uchar* data)
+{
+    if (raidmeta.type != RAID5D)
+        panic("wrong raid function called\n");
+
+    if (vblkn < 0 || vblkn >= raidblockn())
+        return -1;
+
+    struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+    struct DiskInfo* diskinfo = raidmeta.diskinfo;
+
+    uint64 tile;
+    int j, m, pm;
+    locateraid5d(vblkn, &tile, &j, &m, &pm);
+
+    uint64 clustern = tile / DCL_TILES_PER_CLUSTER;
+
+    uchar* page = (uchar*) kalloc();
+    uchar* prevdata = page;
+    uchar* parity = page + BSIZE;
+    uchar* buff = page + 2 * BSIZE;
+
+    // REPAIR - LOCK -ADD
+    acquire(&raiddata->repairlock);
+    while (raiddata->repairing)
+    {
+        trace(TR_GATEWAIT, 0);
+        sleep(&raiddata->repairing, &raiddata->repairlock);
+    }
+    trace(TR_GATEPASS, 0);
+    raiddata->writecount++;
+    release(&raiddata->repairlock);
+
+    // spared disk can change while repair is running, so permutation is taken after it
+    uint8 perm[DISKS];
+    tilepermraid5d(tile, perm, 1);
+    int diskn = memberdiskraid5d(perm, j, m);
+    int paritydiskn = memberdiskraid5d(perm, j, pm);
+    uint64 row = tile * DCL_GROUP;
+
+    int ret = 0;
+
+    acquiresleep(&raiddata->clusterlock);
+    if (!raiddata->cluster_loaded[clustern])
+    {
+        loadclusterraid5d(clustern);
+    }
+    releasesleep(&raiddata->clusterlock);
+
+    if (!diskinfo[diskn].valid)
+    {
+        if (!groupvalidraid5d(perm, j, m))
+        {
+            ret = -1;
+            goto raid5dwriteend;
+        }
+
+        // acquire every disk lock
+        for (int i = 0; i < DISKS; i++)
+            acquiresleep(&diskinfo[i].lock);
+
+        reconstructraid5d(tile, perm, j, m, prevdata, buff);
+        raidstat_event(STAT_DEGRADED);
+        read_block(diskinfo[paritydiskn].diskn, row + pm, parity);
+        raidstat_event(STAT_PARITYREAD);
+
+        trace(TR_PARITY, 0);
+        for (int i = 0; i < BSIZE; i++)
+            parity[i] ^= prevdata[i] ^ data[i];
+        trace(TR_PARITYDONE, 0);
+
+        write_block(diskinfo[paritydiskn].diskn, row + pm, parity);
+
+        // release all disk locks
+        for (int i = 0; i < DISKS; i++)
+            releasesleep(&diskinfo[i].lock);
+    }
+    else if (!diskinfo[paritydiskn].valid)
+    {
+        acquiresleep(&diskinfo[diskn].lock);
+        write_block(diskinfo[diskn].diskn, row + m, data);
+        releasesleep(&diskinfo[diskn].lock);
+    }
+    else
+    {
+        // ascending order of disks - avoiding deadlock
+        int first = diskn < paritydiskn ? diskn : paritydiskn;
+        int second = diskn < paritydiskn ? paritydiskn : diskn;
+        acquiresleep(&diskinfo[first].lock);
+        acquiresleep(&diskinfo[second].lock);
+
+        read_block(diskinfo[diskn].diskn, row + m, prevdata);
+        read_block(diskinfo[paritydiskn].diskn, row + pm, parity);
+        raidstat_event(STAT_PARITYREAD);
+
+        trace(TR_PARITY, 0);
+        for (int i = 0; i < BSIZE; i++)
+            parity[i] ^= prevdata[i] ^ data[i];
+        trace(TR_PARITYDONE, 0);
+
+        write_block(diskinfo[diskn].diskn, row + m, data);
+        // write new parity
+        write_block(diskinfo[paritydiskn].diskn, row + pm, parity);
+
+        releasesleep(&diskinfo[second].lock);
+        releasesleep(&diskinfo[first].lock);
+    }
+
+raid5dwriteend:
+    kfree(page);
+
+    // REPAIR - LOCK -ADD
+    acquire(&raiddata->repairlock);
+    raiddata->writecount--;
+    if (raiddata->writecount == 0)
+    {
+        wakeup(&raiddata->writecount);
+    }
+    release(&raiddata->repairlock);
+
+    return ret;
+}
+
+// stop writers and take every disk lock - same gate as RAID4/RAID5 repair
+static void
+beginrepairraid5d(void)
+{
+    struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+
+    acquire(&raiddata->repairlock);
+    raiddata->repairing++;
+    while (raiddata->writecount != 0 && raiddata->repairing != 0)
+    {
+        sleep(&raiddata->writecount, &raiddata->repairlock);
+    }
+    release(&raiddata->repairlock);
+
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&raidmeta.diskinfo[i].lock);
+}
+
+static void
+endrepairraid5d(void)
+{
+    struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&raidmeta.diskinfo[i].lock);
+
+    acquire(&raiddata->repairlock);
+    raiddata->repairing--;
+    if (raiddata->repairing == 0)
+    {
+        wakeup(&raiddata->repairing);
+    }
+    release(&raiddata->repairlock);
+}
+
+// tiles rebuilt together, and their blocks read for it - every group of the failed disk but its member there
+#define SPARE_TILES 2
+#define SPARE_BLOCKS (SPARE_TILES * DCL_GROUP * (DCL_GROUP - 1))
+#define SPARE_PAGES ((SPARE_BLOCKS + PGSIZE / BSIZE - 1) / (PGSIZE / BSIZE))
+
+// disk failed - raidd rebuilds it into distributed spare in background (sparestepraid5d)
+void
+sparefailraid5d(int diskn)
+{
+    struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+
+    // spare is already used, or some other disk is invalid as well - stay degraded
+    if (raiddata->spared >= 0)
+        return;
+    for (int i = 0; i < DISKS; i++)
+        if (i != diskn && !raidmeta.diskinfo[i].valid)
+            return;
+
+    // no tile is in spare yet - requests in progress see the same layout
+    beginrepairraid5d();
+    raiddata->spared = diskn;
+    raiddata->sparedtiles = 0;
+    endrepairraid5d();
+
+    raiddwakeup();
+}
+
+// is there a part of spared disk left to rebuild into spare, and the rest of its groups to do it from
+int
+sparependingraid5d(void)
+{
+    struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+
+    if (raidmeta.isDestroyed || raidmeta.type != RAID5D)
+        return 0;
+    if (raiddata->spared < 0 || raiddata->sparedtiles >= tilesraid5d())
+        return 0;
+
+    for (int i = 0; i < DISKS; i++)
+        if (i != raiddata->spared && !raidmeta.diskinfo[i].valid)
+            return 0;
+    return 1;
+}
+
+// rebuild blocks of disk diskn in tiles [from, to) into spare of every tile
+// reads of all their groups are submitted together, and then all writes, so both go to every disk at once
+// disk locks must be held when called
+static void
+sparetilesraid5d(uint64 from, uint64 to, int diskn, uchar** blk)
+{
+    // reads, then writes - fewer of them
+    int disks[SPARE_BLOCKS];
+    int blockno[SPARE_BLOCKS];
+    uchar* out[SPARE_TILES * DCL_GROUP];
+
+    int k = 0;
+    for (uint64 tile = from; tile < to; tile++)
+    {
+        uint8 perm[DISKS];
+        tilepermraid5d(tile, perm, 0);
+
+        int p = positionraid5d(perm, diskn);
+        if (p == DCL_COLUMNS)
+            continue;           // failed disk is spare of this tile
+
+        // members of group of row m follow one another in blk
+        for (int m = 0; m < DCL_GROUP; m++)
+        {
+            int j = (p - m + DCL_COLUMNS) % DCL_COLUMNS;
+            for (int i = 0; i < DCL_GROUP; i++)
+            {
+                if (i == m)
+                    continue;
+                disks[k] = raidmeta.diskinfo[memberdiskraid5d(perm, j, i)].diskn;
+                blockno[k] = tile * DCL_GROUP + i;
+                k++;
+            }
+        }
+    }
+    if (k == 0)
+        return;
+    gather_blocks(k, disks, blockno, blk);
+
+    // xor of every group goes into its first member read, which is written to spare
+    int n = 0;
+    for (uint64 tile = from; tile < to; tile++)
+    {
+        uint8 perm[DISKS];
+        tilepermraid5d(tile, perm, 0);
+        if (positionraid5d(perm, diskn) == DCL_COLUMNS)
+            continue;
+
+        for (int m = 0; m < DCL_GROUP; m++)
+        {
+            uchar* data = blk[n * (DCL_GROUP - 1)];
+            for (int i = 1; i < DCL_GROUP - 1; i++)
+                for (int b = 0; b < BSIZE; b++)
+                    data[b] ^= blk[n * (DCL_GROUP - 1) + i][b];
+
+            out[n] = data;
+            disks[n] = raidmeta.diskinfo[perm[DCL_COLUMNS]].diskn;
+            blockno[n] = tile * DCL_GROUP + m;
+            n++;
+        }
+    }
+    scatter_blocks(n, disks, blockno, out);
+}
+
+// one step of rebuild into spare - a cluster of tiles, then the watermark moves. called by raidd
+// writers are stopped only for the step, so the array keeps serving requests meanwhile
+void
+sparestepraid5d(void)
+{
+    struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+
+    uchar* page[SPARE_PAGES];
+    uchar* blk[SPARE_BLOCKS];
+    for (int i = 0; i < SPARE_PAGES; i++)
+        page[i] = (uchar*) kalloc();
+    for (int k = 0; k < SPARE_BLOCKS; k++)
+        blk[k] = page[k / (PGSIZE / BSIZE)] + k % (PGSIZE / BSIZE) * BSIZE;
+
+    beginrepairraid5d();
+
+    // disk could fail or be repaired since raidd looked
+    if (sparependingraid5d())
+    {
+        uint64 from = raiddata->sparedtiles;
+        uint64 to = from + DCL_TILES_PER_CLUSTER;
+        if (to > tilesraid5d())
+            to = tilesraid5d();
+
+        // if cluster has not been loaded before, no need for repair
+        if (tileloadedraid5d(from))
+            for (uint64 tile = from; tile < to; tile += SPARE_TILES)
+                sparetilesraid5d(tile, tile + SPARE_TILES < to ? tile + SPARE_TILES : to, raiddata->spared, blk);
+
+        raiddata->sparedtiles = to;
+    }
+
+    endrepairraid5d();
+
+    for (int i = 0; i < SPARE_PAGES; i++)
+        kfree(page[i]);
+}
+
+// replaced disk is back
+// if its blocks are in spares, copy them back and free the spare
+// otherwise rebuild it in place from the rest of every group
+int
+repairraid5d(int diskn)
+{
+    struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+
+    // blocks that are not in spare come from the rest of their groups
+    int partial = raiddata->sparedtiles < tilesraid5d();
+    for (int i = 0; i < DISKS; i++)
+        if (i != diskn && !raidmeta.diskinfo[i].valid && (i != raiddata->spared || partial))
+            return -1;
+
+    uchar* page = (uchar*) kalloc();
+    uchar* data = page;
+    uchar* buff = page + BSIZE;
+
+    beginrepairraid5d();
+
+    for (uint64 tile = 0; tile < tilesraid5d(); tile++)
+    {
+        if (!tileloadedraid5d(tile))
+            continue;
+
+        uint8 perm[DISKS];
+        tilepermraid5d(tile, perm, raiddata->spared != diskn);
+
+        int p = positionraid5d(perm, diskn);
+        if (p == DCL_COLUMNS)
+            continue;
+
+        for (int m = 0; m < DCL_GROUP; m++)
+        {
+            if (raiddata->spared == diskn && tile < raiddata->sparedtiles)
+            {
+                read_block(raidmeta.diskinfo[perm[DCL_COLUMNS]].diskn, tile * DCL_GROUP + m, data);
+            }
+            else
+            {
+                int j = (p - m + DCL_COLUMNS) % DCL_COLUMNS;
+                reconstructraid5d(tile, perm, j, m, data, buff);
+            }
+            write_block(raidmeta.diskinfo[diskn].diskn, tile * DCL_GROUP + m, data);
+        }
+    }
+
+    if (raiddata->spared == diskn)
+    {
+        raiddata->spared = -1;
+        raiddata->sparedtiles = 0;
+    }
+    raidmeta.diskinfo[diskn].valid = 1;
+
+    endrepairraid5d();
+
+    kfree(page);
+    return 0;
+}
+
+// check parity of every group of the tile starting at row against its data and write it again if it differs,
+// or rebuild a block of the group that fails its checksum (scrubxor)
+// rows inside a tile are skipped, so a pass over all rows checks every tile once - returns number written
+// every disk must be valid, writers stopped and all disk locks held when called
+int
+scrubraid5d(uint64 row)
+{
+    uint64 tile = row / DCL_GROUP;
+    if (row % DCL_GROUP != 0 || tile >= tilesraid5d() || !tileloadedraid5d(tile))
+        return 0;
+
+    uint8 perm[DISKS];
+    tilepermraid5d(tile, perm, 1);
+
+    int found = 0;
+    for (int j = 0; j < DCL_COLUMNS; j++)
+    {
+        int diskn[DCL_GROUP];
+        uint64 blockno[DCL_GROUP];
+        for (int m = 0; m < DCL_GROUP; m++)
+        {
+            diskn[m] = raidmeta.diskinfo[memberdiskraid5d(perm, j, m)].diskn;
+            blockno[m] = tile * DCL_GROUP + m;
+        }
+
+        found += scrubxor(diskn, blockno, DCL_GROUP, paritymemberraid5d(j));
+    }
+
+    return found;
+}
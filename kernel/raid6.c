@@ -0,0 +1,633 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "raid.h"
+#include "raidstat.h"
+#include "trace.h"
+
+// global variable
+extern struct RAIDMeta raidmeta;
+
+// GF(2^8) over x^8 + x^4 + x^3 + x^2 + 1 (0x11d) with generator 2 - same field as Linux md
+// P is plain xor of data, Q is sum of g^pos * data over data positions of stripe
+static uchar gflog[256];
+static uchar gfexp[512];            // doubled, so gfexp[log a + log b] needs no mod 255
+
+// fill log/exp tables - called when raid is loaded or initialized
+void
+gfinit(void)
+{
+    int x = 1;
+    for (int i = 0; i < 255; i++)
+    {
+        gfexp[i] = gfexp[i + 255] = x;
+        gflog[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= 0x11d;
+    }
+}
+
+static uchar
+gfmul(uchar a, uchar b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return gfexp[gflog[a] + gflog[b]];
+}
+
+static uchar
+gfinv(uchar a)
+{
+    return gfexp[255 - gflog[a]];
+}
+
+// g^n
+static uchar
+gfpow2(int n)
+{
+    return gfexp[n % 255];
+}
+
+// multiply every byte of word by 2 at once
+static uint64
+gfmul2word(uint64 w)
+{
+    uint64 mask = w & 0x8080808080808080ULL;
+    mask = (mask << 1) - (mask >> 7);           // 0xff in every byte which had its high bit set
+    return ((w << 1) & 0xfefefefefefefefeULL) ^ (mask & 0x1d1d1d1d1d1d1d1dULL);
+}
+
+// dst ^= src, word at a time - blocks are kalloc'd, so aligned
+static void
+xorblock(uchar* dst, uchar* src)
+{
+    uint64* d = (uint64*)dst;
+    uint64* s = (uint64*)src;
+    for (int i = 0; i < BSIZE / sizeof(uint64); i++)
+        d[i] ^= s[i];
+}
+
+// dst ^= c * src
+// split-nibble tables: c * b = c * (b & 0xf) ^ c * (b & 0xf0), so 32 table entries cover any byte
+static void
+gfmulxor(uchar* dst, uchar* src, uchar c)
+{
+    uchar lo[16], hi[16];
+    for (int i = 0; i < 16; i++)
+    {
+        lo[i] = gfmul(c, i);
+        hi[i] = gfmul(c, i << 4);
+    }
+
+    for (int i = 0; i < BSIZE; i++)
+        dst[i] ^= lo[src[i] & 0xf] ^ hi[src[i] >> 4];
+}
+
+// P and Q of n data blocks (ordered by position in stripe), Q by Horner's rule
+static void
+gensyndrome(uchar** data, int n, uchar* p, uchar* q)
+{
+    uint64* wp = (uint64*)p;
+    uint64* wq = (uint64*)q;
+
+    for (int w = 0; w < BSIZE / sizeof(uint64); w++)
+    {
+        uint64 pv = ((uint64*)data[n - 1])[w];
+        uint64 qv = pv;
+        for (int d = n - 2; d >= 0; d--)
+        {
+            uint64 v = ((uint64*)data[d])[w];
+            pv ^= v;
+            qv = gfmul2word(qv) ^ v;
+        }
+        wp[w] = pv;
+        wq[w] = qv;
+    }
+}
+
+// P rotates from the last disk down, Q is right after it and data follows Q (left-symmetric)
+uint64
+raid6paritydisk(uint64 stripe)
+{
+    return DISKS - 1 - stripe % DISKS;
+}
+
+uint64
+raid6qdisk(uint64 stripe)
+{
+    return (raid6paritydisk(stripe) + 1) % DISKS;
+}
+
+// disk holding data block on position stripepos [0, DISKS - 3] of stripe
+uint64
+raid6datadisk(uint64 stripe, uint64 stripepos)
+{
+    return (raid6paritydisk(stripe) + 2 + stripepos) % DISKS;
+}
+
+#define RAID6BLOCKS (DISKS + 2)
+#define RAID6PAGES ((RAID6BLOCKS + PGSIZE / BSIZE - 1) / (PGSIZE / BSIZE))
+
+// scratch for a whole stripe - block per disk and two more for recomputed syndromes
+struct raid6stripe
+{
+    uchar* blk[DISKS];
+    uchar* p;
+    uchar* q;
+    uchar* page[RAID6PAGES];
+};
+
+static void
+stripealloc(struct raid6stripe* s)
+{
+    uchar* blk[RAID6BLOCKS];
+    for (int i = 0; i < RAID6PAGES; i++)
+    {
+        s->page[i] = (uchar*)kalloc();
+        if (!s->page[i])
+            panic("raid6 stripe kalloc");
+        for (int j = 0; j < PGSIZE / BSIZE && i * (PGSIZE / BSIZE) + j < RAID6BLOCKS; j++)
+            blk[i * (PGSIZE / BSIZE) + j] = s->page[i] + j * BSIZE;
+    }
+
+    for (int i = 0; i < DISKS; i++)
+        s->blk[i] = blk[i];
+    s->p = blk[DISKS];
+    s->q = blk[DISKS + 1];
+}
+
+static void
+stripefree(struct raid6stripe* s)
+{
+    for (int i = 0; i < RAID6PAGES; i++)
+        kfree(s->page[i]);
+}
+
+// read whole stripe into s->blk (indexed by disk) and recompute blocks of up to 2 invalid disks
+// disk bad (-1 if none) is recomputed as well, as if it were invalid
+// all disk locks must be held when called
+// returns -1 if more than 2 disks are invalid
+int
+readstriperaid6(uint64 stripe, struct raid6stripe* s, int bad)
+{
+    struct DiskInfo* diskinfo = raidmeta.diskinfo;
+    uint64 pdisk = raid6paritydisk(stripe);
+    uint64 qdisk = raid6qdisk(stripe);
+    int ndata = DISKS - 2;
+
+    uchar* data[DISKS];
+    int lost[2];            // data positions which must be recomputed
+    int nlost = 0, nfailed = 0;
+
+    for (int pos = 0; pos < ndata; pos++)
+        data[pos] = s->blk[raid6datadisk(stripe, pos)];
+
+    for (int i = 0; i < DISKS; i++)
+    {
+        if (i != bad && blockvalid(&diskinfo[i], stripe))
+        {
+            read_block(diskinfo[i].diskn, stripe, s->blk[i]);
+            continue;
+        }
+
+        if (++nfailed > 2)
+            return -1;
+
+        memset(s->blk[i], 0, BSIZE);
+        if (i != pdisk && i != qdisk)
+            lost[nlost++] = (i - (int)pdisk - 2 + 2 * DISKS) % DISKS;
+    }
+
+    if (nlost == 0)
+    {
+        // only syndromes lost - recompute them
+        gensyndrome(data, ndata, s->p, s->q);
+    }
+    else if (nlost == 1 && pdisk != bad && blockvalid(&diskinfo[pdisk], stripe))
+    {
+        // plain raid5 reconstruction from P
+        int x = lost[0];
+        memmove(data[x], s->blk[pdisk], BSIZE);
+        for (int pos = 0; pos < ndata; pos++)
+            if (pos != x)
+                xorblock(data[x], data[pos]);
+        gensyndrome(data, ndata, s->p, s->q);
+    }
+    else if (nlost == 1)
+    {
+        // data and P lost: Q ^ Q(without x) = g^x * Dx
+        int x = lost[0];
+        gensyndrome(data, ndata, s->p, s->q);
+        xorblock(s->q, s->blk[qdisk]);
+        gfmulxor(data[x], s->q, gfinv(gfpow2(x)));
+        gensyndrome(data, ndata, s->p, s->q);
+    }
+    else
+    {
+        // two data blocks lost, P and Q are valid
+        // Pxy = Dx ^ Dy, Qxy = g^x Dx ^ g^y Dy  =>  Dx = (g^y Pxy ^ Qxy) / (g^x ^ g^y), Dy = Pxy ^ Dx
+        int x = lost[0], y = lost[1];
+        gensyndrome(data, ndata, s->p, s->q);
+        xorblock(s->p, s->blk[pdisk]);
+        xorblock(s->q, s->blk[qdisk]);
+
+        uchar denom = gfinv(gfpow2(x) ^ gfpow2(y));
+        gfmulxor(data[x], s->p, gfmul(gfpow2(y), denom));
+        gfmulxor(data[x], s->q, denom);
+
+        memmove(data[y], s->p, BSIZE);
+        xorblock(data[y], data[x]);
+
+        gensyndrome(data, ndata, s->p, s->q);
+    }
+
+    // lost syndromes are in s->p, s->q - put them in place of disks, so every block of stripe is valid
+    if (pdisk == bad || !blockvalid(&diskinfo[pdisk], stripe))
+        memmove(s->blk[pdisk], s->p, BSIZE);
+    if (qdisk == bad || !blockvalid(&diskinfo[qdisk], stripe))
+        memmove(s->blk[qdisk], s->q, BSIZE);
+
+    return 0;
+}
+
+// cluster lock must be held when calling
+int
+loadclusterraid6(uint64 clustern)
+{
+    if (raidmeta.type != RAID6)
+        panic("wrong raid function called\n");
+
+    if (clustern < 0 || clustern >= DISK_SIZE_BYTES / BSIZE / CLUSTER_SIZE)
+        panic("Wrong cluster number in loading...");
+
+    trace(TR_CLUSTERLOAD, clustern);
+
+    struct raid6stripe s;
+    stripealloc(&s);
+
+    struct RAID6Data* raiddata = &raidmeta.data.raid6;
+    struct DiskInfo* diskinfo = raidmeta.diskinfo;
+
+    // acquire all disk locks
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&raidmeta.diskinfo[i].lock);
+
+    // last cluster ends at checksum region
+    uint64 startblock = clustern * CLUSTER_SIZE;
+    for (uint64 stripe = startblock; stripe < startblock + CLUSTER_SIZE && stripe < diskblockn(); stripe++)
+    {
+        uchar* data[DISKS];
+        for (int pos = 0; pos < DISKS - 2; pos++)
+        {
+            int diskn = raid6datadisk(stripe, pos);
+            data[pos] = s.blk[diskn];
+            if (blockvalid(&diskinfo[diskn], stripe))
+                read_block(diskinfo[diskn].diskn, stripe, data[pos]);
+            else
+                memset(data[pos], 0, BSIZE);
+        }
+
+        gensyndrome(data, DISKS - 2, s.p, s.q);
+
+        uint64 pdisk = raid6paritydisk(stripe);
+        uint64 qdisk = raid6qdisk(stripe);
+        if (blockvalid(&diskinfo[pdisk], stripe))
+            write_block(diskinfo[pdisk].diskn, stripe, s.p);
+        if (blockvalid(&diskinfo[qdisk], stripe))
+            write_block(diskinfo[qdisk].diskn, stripe, s.q);
+    }
+
+    raiddata->cluster_loaded[clustern] = 1;
+    raidstat_event(STAT_CLUSTERLOAD);
+
+    // release all disk locks
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&raidmeta.diskinfo[i].lock);
+
+    writeraidmeta();
+    trace(TR_CLUSTERDONE, clustern);
+
+    stripefree(&s);
+    return 0;
+}
+
+// rebuild content of disk diskn in blocks [from, to) of every loaded cluster
+// writers must be stopped and all disk locks held when called
+void
+repairraid6(int diskn, uint64 from, uint64 to)
+{
+    struct RAID6Data* raiddata = &raidmeta.data.raid6;
+    struct raid6stripe s;
+    stripealloc(&s);
+
+    for (uint64 b = from; b < to; b++)
+    {
+        // if cluster has not been loaded before, no need for repair
+        acquiresleep(&raiddata->clusterlock);
+        if (!raiddata->cluster_loaded[b / CLUSTER_SIZE])
+        {
+            releasesleep(&raiddata->clusterlock);
+            continue;
+        }
+        releasesleep(&raiddata->clusterlock);
+
+        if (readstriperaid6(b, &s, -1) < 0)
+            panic("raid6 repair");
+        write_block(raidmeta.diskinfo[diskn].diskn, b, s.blk[diskn]);
+    }
+
+    stripefree(&s);
+}
+
+// check P and Q of stripe against its data and write the ones that differ again, or rebuild a block that
+// fails its checksum from the rest of the stripe instead - returns number written
+// every disk must be valid, writers stopped and all disk locks held when called
+int
+scrubraid6(uint64 stripe)
+{
+    struct RAID6Data* raiddata = &raidmeta.data.raid6;
+
+    // syndromes of cluster not loaded yet were never set up
+    acquiresleep(&raiddata->clusterlock);
+    int loaded = raiddata->cluster_loaded[stripe / CLUSTER_SIZE];
+    releasesleep(&raiddata->clusterlock);
+    if (!loaded)
+        return 0;
+
+    struct raid6stripe s;
+    stripealloc(&s);
+
+    // with no disk lost, s.p and s.q are recomputed from data and blocks of P and Q disks are as read
+    if (readstriperaid6(stripe, &s, -1) < 0)
+        panic("raid6 scrub");
+
+    // syndromes made to match a rotted block would lose it
+    int bad = -1, nbad = 0;
+    for (int i = 0; i < DISKS; i++)
+    {
+        if (csumcheck(raidmeta.diskinfo[i].diskn, stripe, s.blk[i]) < 0)
+        {
+            bad = i;
+            nbad++;
+        }
+    }
+
+    int found = 0;
+    uint64 pdisk = raid6paritydisk(stripe);
+    uint64 qdisk = raid6qdisk(stripe);
+    if (nbad == 1)
+    {
+        // recomputed as if its disk were lost, written back if the result passes
+        if (readstriperaid6(stripe, &s, bad) == 0 && csumcheck(raidmeta.diskinfo[bad].diskn, stripe, s.blk[bad]) == 0)
+        {
+            write_block(raidmeta.diskinfo[bad].diskn, stripe, s.blk[bad]);
+            found++;
+        }
+    }
+    else if (nbad == 0)
+    {
+        if (memcmp(s.blk[pdisk], s.p, BSIZE) != 0)
+        {
+            write_block(raidmeta.diskinfo[pdisk].diskn, stripe, s.p);
+            found++;
+        }
+        if (memcmp(s.blk[qdisk], s.q, BSIZE) != 0)
+        {
+            write_block(raidmeta.diskinfo[qdisk].diskn, stripe, s.q);
+            found++;
+        }
+    }
+
+    stripefree(&s);
+    return found;
+}
+
+static int
+invalidcountraid6(void)
+{
+    int count = 0;
+    for (int i = 0; i < DISKS; i++)
+        if (!raidmeta.diskinfo[i].valid)
+            count++;
+    return count;
+}
+
+// block read from disk does not match its checksum - rebuild it from the rest of the stripe,
+// and write it back if the result matches
+static uint64
+fixblockraid6(int diskn, uint64 stripe, uchar* data)
+{
+    struct raid6stripe s;
+    stripealloc(&s);
+
+    // acquire every disk lock
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&raidmeta.diskinfo[i].lock);
+
+    int ok = readstriperaid6(stripe, &s, diskn) == 0 &&
+             csumcheck(raidmeta.diskinfo[diskn].diskn, stripe, s.blk[diskn]) == 0;
+    if (ok)
+    {
+        write_block(raidmeta.diskinfo[diskn].diskn, stripe, s.blk[diskn]);
+        memmove(data, s.blk[diskn], BSIZE);
+    }
+
+    // release all disk locks
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&raidmeta.diskinfo[i].lock);
+
+    stripefree(&s);
+    return ok ? 0 : -1;
+}
+
+uint64
+raid6read(int vblkn, uchar* data)
+{
+    if (raidmeta.type != RAID6)
+        panic("wrong raid function called\n");
+
+    if (vblkn < 0 || vblkn >= raidblockn())
+        return -1;
+
+    uint64 stripe = vblkn / (DISKS - 2);
+    uint64 stripepos = vblkn % (DISKS - 2);
+    uint64 diskn = raid6datadisk(stripe, stripepos);
+
+    struct DiskInfo* diskinfo = raidmeta.diskinfo;
+
+    if (blockvalid(&diskinfo[diskn], stripe))
+    {
+        acquiresleep(&diskinfo[diskn].lock);
+        read_block(diskinfo[diskn].diskn, stripe, data);
+        int bad = csumcheck(diskinfo[diskn].diskn, stripe, data) < 0;
+        releasesleep(&diskinfo[diskn].lock);
+
+        return bad ? fixblockraid6(diskn, stripe, data) : 0;
+    }
+
+    // more than 2 invalid disks - cannot be repaired
+    if (invalidcountraid6() > 2)
+        return -1;
+
+    struct raid6stripe s;
+    stripealloc(&s);
+
+    // acquire every disk lock
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&diskinfo[i].lock);
+
+    int ret = readstriperaid6(stripe, &s, -1);
+    raidstat_event(STAT_DEGRADED);
+    if (ret == 0)
+        memmove(data, s.blk[diskn], BSIZE);
+
+    // release all disk locks
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&diskinfo[i].lock);
+
+    stripefree(&s);
+    return ret;
+}
+
+uint64
+raid6write(int vblkn, uchar* data)
+{
+    if (raidmeta.type != RAID6)
+        panic("wrong raid function called\n");
+
+    if (vblkn < 0 || vblkn >= raidblockn())
+        return -1;
+
+    uint64 stripe = vblkn / (DISKS - 2);
+    uint64 stripepos = vblkn % (DISKS - 2);
+    uint64 diskn = raid6datadisk(stripe, stripepos);
+    uint64 pdisk = raid6paritydisk(stripe);
+    uint64 qdisk = raid6qdisk(stripe);
+
+    struct DiskInfo* diskinfo = raidmeta.diskinfo;
+
+    if (invalidcountraid6() > 2)
+        return -1;
+
+    struct RAID6Data* raiddata = &raidmeta.data.raid6;
+
+    uint64 clustern = stripe / CLUSTER_SIZE;
+
+    // REPAIR - LOCK -ADD
+    acquire(&raiddata->repairlock);
+    while (raiddata->repairing)
+    {
+        trace(TR_GATEWAIT, 0);
+        sleep(&raiddata->repairing, &raiddata->repairlock);
+    }
+    trace(TR_GATEPASS, 0);
+    raiddata->writecount++;
+    release(&raiddata->repairlock);
+
+    acquiresleep(&raiddata->clusterlock);
+    if (!raiddata->cluster_loaded[clustern])
+    {
+        loadclusterraid6(clustern);
+    }
+    releasesleep(&raiddata->clusterlock);
+
+    int ret = 0;
+
+    if (blockvalid(&diskinfo[diskn], stripe) && blockvalid(&diskinfo[pdisk], stripe) && blockvalid(&diskinfo[qdisk], stripe))
+    {
+        // read-modify-write: delta = old ^ new, P ^= delta, Q ^= g^pos * delta
+        uchar* page = (uchar*) kalloc();
+        uchar* delta = page;
+        uchar* parity = page + BSIZE;
+        uchar* q = page + 2 * BSIZE;
+
+        // take locks in ascending order of disks - avoiding deadlock
+        uint64 order[3] = {diskn, pdisk, qdisk};
+        for (int i = 0; i < 3; i++)
+            for (int j = i + 1; j < 3; j++)
+                if (order[j] < order[i])
+                {
+                    uint64 tmp = order[i];
+                    order[i] = order[j];
+                    order[j] = tmp;
+                }
+
+        for (int i = 0; i < 3; i++)
+            acquiresleep(&diskinfo[order[i]].lock);
+
+        read_block(diskinfo[diskn].diskn, stripe, delta);
+        read_block(diskinfo[pdisk].diskn, stripe, parity);
+        read_block(diskinfo[qdisk].diskn, stripe, q);
+        raidstat_event(STAT_PARITYREAD);
+        raidstat_event(STAT_PARITYREAD);
+
+        trace(TR_PARITY, 0);
+        for (int i = 0; i < BSIZE; i++)
+            delta[i] ^= data[i];
+
+        xorblock(parity, delta);
+        gfmulxor(q, delta, gfpow2(stripepos));
+        trace(TR_PARITYDONE, 0);
+
+        write_block(diskinfo[diskn].diskn, stripe, data);
+        write_block(diskinfo[pdisk].diskn, stripe, parity);
+        write_block(diskinfo[qdisk].diskn, stripe, q);
+
+        for (int i = 2; i >= 0; i--)
+            releasesleep(&diskinfo[order[i]].lock);
+
+        kfree(page);
+    }
+    else
+    {
+        // degraded - recompute whole stripe and write what can be written
+        struct raid6stripe s;
+        stripealloc(&s);
+
+        // acquire every disk lock
+        for (int i = 0; i < DISKS; i++)
+            acquiresleep(&diskinfo[i].lock);
+
+        ret = readstriperaid6(stripe, &s, -1);
+        raidstat_event(STAT_DEGRADED);
+        if (ret == 0)
+        {
+            uchar* stripedata[DISKS];
+            for (int pos = 0; pos < DISKS - 2; pos++)
+                stripedata[pos] = s.blk[raid6datadisk(stripe, pos)];
+
+            memmove(s.blk[diskn], data, BSIZE);
+            gensyndrome(stripedata, DISKS - 2, s.p, s.q);
+
+            if (blockvalid(&diskinfo[diskn], stripe))
+                write_block(diskinfo[diskn].diskn, stripe, data);
+            if (blockvalid(&diskinfo[pdisk], stripe))
+                write_block(diskinfo[pdisk].diskn, stripe, s.p);
+            if (blockvalid(&diskinfo[qdisk], stripe))
+                write_block(diskinfo[qdisk].diskn, stripe, s.q);
+        }
+
+        // release all disk locks
+        for (int i = 0; i < DISKS; i++)
+            releasesleep(&diskinfo[i].lock);
+
+        stripefree(&s);
+    }
+
+    // REPAIR - LOCK -ADD
+    acquire(&raiddata->repairlock);
+    raiddata->writecount--;
+    if (raiddata->writecount == 0)
+    {
+        wakeup(&raiddata->writecount);
+    }
+    release(&raiddata->repairlock);
+
+    return ret;
+}
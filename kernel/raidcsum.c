@@ -0,0 +1,293 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "raid.h"
+#include "raidstat.h"
+
+// global variable
+extern struct RAIDMeta raidmeta;
+
+// Per-block checksums.
+// When raidmeta.checksums is on, every block written to a disk below diskblockn() gets its CRC32C
+// in the checksum region of the same disk (CSUM_BLOCKS blocks between data and raidmeta), so data
+// and parity blocks are covered alike. Reads check the block against it, and engines rebuild a
+// block that fails from the mirror or the rest of the stripe. Slot 0 means no checksum is known -
+// regions are cleared when checksums are turned on and when a disk gets new content, and a CRC of 0
+// is kept as ~0. Checksum blocks are cached (LRU, like bio.c) and written through.
+
+#define CRC32C_POLY 0x82f63b78          // reflected Castagnoli polynomial
+
+// checksum blocks kept in memory
+#define NCSUMBUF 16
+
+static uint32 crctable[8][256];
+
+struct csumbuf
+{
+    struct sleeplock lock;              // held while content is read or changed
+    int valid;                          // content read from disk
+    int refcnt;
+    int diskn;                          // physical disk, 0 if none
+    uint64 blockno;                     // block of the checksum region
+    uint64 used;                        // clock of last use
+    uint32 sum[CSUMS_PER_BLOCK];
+};
+
+static struct
+{
+    struct spinlock lock;               // protects everything but content of buffers
+    uint64 clock;
+    struct csumbuf buf[NCSUMBUF];
+} csumcache;
+
+// slicing-by-8 - table k gives CRC of byte followed by k zero bytes, so 8 bytes take 8 lookups
+static void
+crcinit(void)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        uint32 c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crctable[0][i] = c;
+    }
+
+    for (int i = 0; i < 256; i++)
+        for (int k = 1; k < 8; k++)
+            crctable[k][i] = (crctable[k - 1][i] >> 8) ^ crctable[0][crctable[k - 1][i] & 0xff];
+}
+
+// CRC32C of n bytes - data is read 8 bytes at a time, little endian
+uint32
+crc32c(uchar* data, int n)
+{
+    uint32 crc = ~0U;
+
+    for (; n >= 8; n -= 8, data += 8)
+    {
+        uint32 lo = (data[0] | data[1] << 8 | data[2] << 16 | (uint32)data[3] << 24) ^ crc;
+        uint32 hi = data[4] | data[5] << 8 | data[6] << 16 | (uint32)data[7] << 24;
+        crc = crctable[7][lo & 0xff] ^ crctable[6][(lo >> 8) & 0xff] ^
+              crctable[5][(lo >> 16) & 0xff] ^ crctable[4][lo >> 24] ^
+              crctable[3][hi & 0xff] ^ crctable[2][(hi >> 8) & 0xff] ^
+              crctable[1][(hi >> 16) & 0xff] ^ crctable[0][hi >> 24];
+    }
+
+    for (; n > 0; n--, data++)
+        crc = crctable[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+// value kept in slot of block - never 0, that is for none
+static uint32
+blocksum(uchar* data)
+{
+    uint32 crc = crc32c(data, BSIZE);
+    return crc ? crc : ~0U;
+}
+
+// locked buffer with checksum block blockno of disk diskn, read if it was not cached
+static struct csumbuf*
+csumget(int diskn, uint64 blockno)
+{
+    acquire(&csumcache.lock);
+
+    struct csumbuf* b;
+    for (;;)
+    {
+        struct csumbuf* lru = 0;
+        for (b = csumcache.buf; b < csumcache.buf + NCSUMBUF; b++)
+        {
+            if (b->diskn == diskn && b->blockno == blockno)
+                goto found;
+            if (b->refcnt == 0 && (!lru || b->used < lru->used))
+                lru = b;
+        }
+
+        if (lru)
+        {
+            b = lru;
+            b->diskn = diskn;
+            b->blockno = blockno;
+            b->valid = 0;
+            goto found;
+        }
+
+        // every buffer in use - holders never wait for anything but disks
+        sleep(&csumcache, &csumcache.lock);
+    }
+
+found:
+    b->refcnt++;
+    b->used = ++csumcache.clock;
+    release(&csumcache.lock);
+
+    acquiresleep(&b->lock);
+    if (!b->valid)
+    {
+        read_block(diskn, diskblockn() + blockno, (uchar*)b->sum);
+        b->valid = 1;
+    }
+    return b;
+}
+
+static void
+csumput(struct csumbuf* b)
+{
+    releasesleep(&b->lock);
+
+    acquire(&csumcache.lock);
+    if (--b->refcnt == 0)
+        wakeup(&csumcache);
+    release(&csumcache.lock);
+}
+
+static int
+csumblock(int diskn, uint64 blockno)
+{
+    return raidmeta.checksums && diskn > 0 && blockno < diskblockn();
+}
+
+// block was written - keep its checksum, called by write_block
+void
+csumwrite(int diskn, uint64 blockno, uchar* data)
+{
+    if (!csumblock(diskn, blockno))
+        return;
+
+    uint32 sum = blocksum(data);
+    struct csumbuf* b = csumget(diskn, blockno / CSUMS_PER_BLOCK);
+    if (b->sum[blockno % CSUMS_PER_BLOCK] != sum)
+    {
+        b->sum[blockno % CSUMS_PER_BLOCK] = sum;
+        write_block(diskn, diskblockn() + b->blockno, (uchar*)b->sum);
+    }
+    csumput(b);
+}
+
+// does block read from disk match its checksum - 0 if it does or none is known, -1 if not
+// disk lock must be held since the block was read, so no write comes in between
+int
+csumcheck(int diskn, uint64 blockno, uchar* data)
+{
+    if (!csumblock(diskn, blockno))
+        return 0;
+
+    struct csumbuf* b = csumget(diskn, blockno / CSUMS_PER_BLOCK);
+    uint32 sum = b->sum[blockno % CSUMS_PER_BLOCK];
+    csumput(b);
+
+    if (sum == 0 || sum == blocksum(data))
+        return 0;
+
+    printf("raid: checksum mismatch on disk %d block %d\n", diskn, (int)blockno);
+    raidstat_event(STAT_CSUMERROR);
+    return -1;
+}
+
+static void
+clearregion(int diskn)
+{
+    for (uint64 i = 0; i < CSUM_BLOCKS; i++)
+    {
+        struct csumbuf* b = csumget(diskn, i);
+        memset(b->sum, 0, BSIZE);
+        write_block(diskn, diskblockn() + i, (uchar*)b->sum);
+        csumput(b);
+    }
+}
+
+// forget checksums of disk - its content is about to be rebuilt or is not known
+void
+csumclear(int diskn)
+{
+    if (raidmeta.checksums)
+        clearregion(diskn);
+}
+
+// blocks [from, to) were copied from disk to disk - copy their checksums too
+void
+csumcopy(int fromdiskn, int todiskn, uint64 from, uint64 to)
+{
+    if (!raidmeta.checksums)
+        return;
+
+    for (uint64 i = from / CSUMS_PER_BLOCK; i * CSUMS_PER_BLOCK < to; i++)
+    {
+        uint32 sum[CSUMS_PER_BLOCK];
+        struct csumbuf* b = csumget(fromdiskn, i);
+        memmove(sum, b->sum, BSIZE);
+        csumput(b);
+
+        b = csumget(todiskn, i);
+        for (uint64 s = 0; s < CSUMS_PER_BLOCK; s++)
+        {
+            uint64 blockno = i * CSUMS_PER_BLOCK + s;
+            if (blockno >= from && blockno < to)
+                b->sum[s] = sum[s];
+        }
+        write_block(todiskn, diskblockn() + i, (uchar*)b->sum);
+        csumput(b);
+    }
+}
+
+// blocks [from, to) of disk were discarded - device may return anything for them now
+void
+csumforget(int diskn, uint64 from, uint64 to)
+{
+    if (!raidmeta.checksums)
+        return;
+
+    for (uint64 i = from / CSUMS_PER_BLOCK; i * CSUMS_PER_BLOCK < to; i++)
+    {
+        struct csumbuf* b = csumget(diskn, i);
+        for (uint64 s = 0; s < CSUMS_PER_BLOCK; s++)
+        {
+            uint64 blockno = i * CSUMS_PER_BLOCK + s;
+            if (blockno >= from && blockno < to)
+                b->sum[s] = 0;
+        }
+        write_block(diskn, diskblockn() + i, (uchar*)b->sum);
+        csumput(b);
+    }
+}
+
+// turn checksums on or off, -1 only asks - returns the old setting
+// turning them on clears regions of all disks, hot spares included, since they are stale
+int
+checksumraid(int on)
+{
+    if (raidmeta.isDestroyed)
+    {
+        panic("RAID structure was destroyed\n");
+        exit(0);
+    }
+
+    int old = raidmeta.checksums;
+    if (on < 0 || on == old)
+        return old;
+
+    // regions are cleared first, so reads never see stale checksums
+    if (on)
+        for (int diskn = VIRTIO_RAID_DISK_START; diskn <= VIRTIO_RAID_DISK_END; diskn++)
+            clearregion(diskn);
+    raidmeta.checksums = on;
+
+    writeraidmeta();
+    return old;
+}
+
+void
+csuminit(void)
+{
+    initlock(&csumcache.lock, "csumcache");
+    for (int i = 0; i < NCSUMBUF; i++)
+        initsleeplock(&csumcache.buf[i].lock, "csumbuf");
+    crcinit();
+}
@@ -0,0 +1,310 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "raid.h"
+
+// global variable
+extern struct RAIDMeta raidmeta;
+
+uint raid0members(int vblkn);
+uint64 raid5stripe(int vblkn);
+uint64 tilesraid5d(void);
+
+// Discard.
+// discard_raid tells the array that virtual blocks hold nothing any more. They are kept in a bitmap,
+// written to DISCARD_BLOCKS blocks of every disk (like raidmeta) before the call returns, and a write
+// clears the bit of its block on disk before the data goes out. Reads of discarded blocks return zeros
+// without asking the disks. For every cluster the blocks not discarded are counted, and a cluster that
+// has none left is dropped: the disks get a discard of its rows, the level marks it not loaded, so the
+// next write sets up its parity or mirror as in a new array, and rebuild and scrub skip it (rowdiscarded).
+// While reshape moves blocks, clusters are not counted - nothing is skipped until it is done.
+
+#define BITS_PER_BLOCK (BSIZE * 8)
+#define ROW_CLUSTERS (DISK_SIZE_BYTES / BSIZE / CLUSTER_SIZE)
+#define CLUSTERS (DCL_CLUSTERS > ROW_CLUSTERS ? DCL_CLUSTERS : ROW_CLUSTERS)
+
+static struct sleeplock discardlock;        // changes of bitmap and live, and writes of bitmap
+static uint8 bitmap[DISCARD_BLOCKS * BSIZE];    // bit set - virtual block is discarded
+static uint16 live[CLUSTERS];               // blocks of cluster that are not discarded
+static int counted;                         // live is up to date - not while reshape moves blocks
+
+static int
+isdiscarded(uint64 vblkn)
+{
+    return (bitmap[vblkn / 8] >> (vblkn % 8)) & 1;
+}
+
+// rows of one cluster - RAID5D clusters are made of whole tiles
+static uint64
+clusterrows(void)
+{
+    return raidmeta.type == RAID5D ? DCL_TILES_PER_CLUSTER * DCL_GROUP : CLUSTER_SIZE;
+}
+
+// cluster holding virtual block, as cluster_loaded of the level counts them
+static uint64
+vblkcluster(int vblkn)
+{
+    switch (raidmeta.type)
+    {
+        case RAID0:
+            return vblkn / raid0members(vblkn) / CLUSTER_SIZE;
+        case RAID1:
+            return vblkn % diskblockn() / CLUSTER_SIZE;
+        case RAID0_1:
+            return vblkn / (DISKS / 2) / CLUSTER_SIZE;
+        case RAID4:
+            return vblkn / (DISKS - 1) / CLUSTER_SIZE;
+        case RAID5:
+            return raid5stripe(vblkn) / CLUSTER_SIZE;
+        case RAID6:
+            return vblkn / (DISKS - 2) / CLUSTER_SIZE;
+        default:
+            return vblkn / DCL_TILE_DATA / DCL_TILES_PER_CLUSTER;
+    }
+}
+
+// write block k of bitmap to every disk, hot spares included - discardlock must be held
+static void
+writebitmap(uint64 k)
+{
+    for (int i = VIRTIO_RAID_DISK_START; i <= VIRTIO_RAID_DISK_END; i++)
+        write_block(i, discardblockn() + k, bitmap + k * BSIZE);
+}
+
+// mark cluster not loaded - returns 1 if it was
+static int
+unloadcluster(uint64 c)
+{
+    struct sleeplock* clusterlock;
+    uint8* cluster_loaded;
+
+    switch (raidmeta.type)
+    {
+        case RAID1:
+        case RAID0_1:
+        {
+            // no writer of a pair can be in the cluster - all of its blocks are discarded
+            struct DiskPair* diskpair = raidmeta.type == RAID1 ? raidmeta.data.raid1.diskpair : raidmeta.data.raid0_1.diskpair;
+            int pairs = raidmeta.type == RAID1 ? (DISKS + 1) / 2 : DISKS / 2;
+            int loaded = 0;
+            for (int i = 0; i < pairs; i++)
+            {
+                loaded |= mirrorloaded(&diskpair[i], c);
+                diskpair[i].cluster_loaded[c / 8] &= ~(1 << (c % 8));
+            }
+            return loaded;
+        }
+        case RAID4:
+            clusterlock = &raidmeta.data.raid4.clusterlock;
+            cluster_loaded = raidmeta.data.raid4.cluster_loaded;
+            break;
+        case RAID5:
+            clusterlock = &raidmeta.data.raid5.clusterlock;
+            cluster_loaded = raidmeta.data.raid5.cluster_loaded;
+            break;
+        case RAID6:
+            clusterlock = &raidmeta.data.raid6.clusterlock;
+            cluster_loaded = raidmeta.data.raid6.cluster_loaded;
+            break;
+        case RAID5D:
+            clusterlock = &raidmeta.data.raid5d.clusterlock;
+            cluster_loaded = raidmeta.data.raid5d.cluster_loaded;
+            break;
+        default:
+            return 0;
+    }
+
+    acquiresleep(clusterlock);
+    int loaded = cluster_loaded[c];
+    cluster_loaded[c] = 0;
+    releasesleep(clusterlock);
+
+    return loaded;
+}
+
+// last block of cluster was discarded - give its rows back to the disks
+// discardlock must be held, so no write brings the cluster back meanwhile
+static void
+dropcluster(uint64 c)
+{
+    uint64 from = c * clusterrows();
+    uint64 to = from + clusterrows() < diskblockn() ? from + clusterrows() : diskblockn();
+
+    for (int i = 0; i < DISKS; i++)
+    {
+        struct DiskInfo* disk = &raidmeta.diskinfo[i];
+        acquiresleep(&disk->lock);
+        discard_blocks(disk->diskn, from, to - from);
+        csumforget(disk->diskn, from, to);
+        releasesleep(&disk->lock);
+    }
+}
+
+// count blocks of every cluster that are not discarded - discardlock must be held
+// clusters with none must not stay loaded, whatever was saved before reboot or reshape
+static void
+recount(void)
+{
+    memset(live, 0, sizeof(live));
+
+    counted = raidmeta.type >= RAID0 && raidmeta.type <= RAID5D && raidmeta.members == raidmeta.newmembers;
+    if (!counted)
+        return;
+
+    uint64 blocks = raidblockn();
+    for (uint64 v = 0; v < blocks; v++)
+        if (!isdiscarded(v))
+            live[vblkcluster(v)]++;
+
+    int unloaded = 0;
+    for (uint64 c = 0; c < CLUSTERS; c++)
+        if (live[c] == 0 && c * clusterrows() < diskblockn())
+            unloaded |= unloadcluster(c);
+
+    if (unloaded)
+        writeraidmeta();
+}
+
+// is virtual block discarded - bits change only under discardlock, a racing reader sees either state
+int
+discarded(int vblkn)
+{
+    return vblkn >= 0 && vblkn < DISCARD_BITS && isdiscarded(vblkn);
+}
+
+// is cluster of row discarded - rebuild and scrub skip it
+int
+rowdiscarded(uint64 row)
+{
+    uint64 c = row / clusterrows();
+    return counted && c < CLUSTERS && live[c] == 0;
+}
+
+// block is about to be written - it is not discarded any more, and that is on disk before the data
+void
+discardwrite(int vblkn)
+{
+    if (!discarded(vblkn))
+        return;
+
+    acquiresleep(&discardlock);
+    if (isdiscarded(vblkn))
+    {
+        bitmap[vblkn / 8] &= ~(1 << (vblkn % 8));
+        if (counted)
+            live[vblkcluster(vblkn)]++;
+        writebitmap(vblkn / BITS_PER_BLOCK);
+    }
+    releasesleep(&discardlock);
+}
+
+// blocks [blkn, blkn + count) hold nothing any more
+uint64
+discardraid(int blkn, int count)
+{
+    if (raidmeta.isDestroyed)
+    {
+        panic("RAID structure was destroyed\n");
+        exit(0);
+    }
+
+    if (blkn < 0 || count < 0 || (uint64)blkn + count > raidblockn())
+        return -1;
+    if (count == 0)
+        return 0;
+
+    uint8 dropped[CLUSTERS];
+    memset(dropped, 0, sizeof(dropped));
+
+    acquiresleep(&discardlock);
+
+    for (uint64 v = blkn; v < (uint64)blkn + count; v++)
+    {
+        if (isdiscarded(v))
+            continue;
+        bitmap[v / 8] |= 1 << (v % 8);
+        if (counted)
+        {
+            uint64 c = vblkcluster(v);
+            if (--live[c] == 0)
+                dropped[c] = 1;
+        }
+    }
+
+    for (uint64 k = blkn / BITS_PER_BLOCK; k <= (blkn + count - 1) / BITS_PER_BLOCK; k++)
+        writebitmap(k);
+
+    // clusters are unloaded before the disks drop their blocks, so no parity is trusted after that
+    int unloaded = 0;
+    for (uint64 c = 0; c < CLUSTERS; c++)
+        if (dropped[c])
+            unloaded |= unloadcluster(c);
+    if (unloaded)
+        writeraidmeta();
+
+    for (uint64 c = 0; c < CLUSTERS; c++)
+        if (dropped[c])
+            dropcluster(c);
+
+    releasesleep(&discardlock);
+
+    return 0;
+}
+
+// copy blocks [from, to) and their checksums from disk to disk, except clusters that are discarded
+void
+copyused(int fromdiskn, int todiskn, uint64 from, uint64 to)
+{
+    while (from < to)
+    {
+        uint64 end = (from / clusterrows() + 1) * clusterrows();
+        if (end > to)
+            end = to;
+
+        if (!rowdiscarded(from))
+        {
+            copy_blocks(fromdiskn, todiskn, from, end - from);
+            csumcopy(fromdiskn, todiskn, from, end);
+        }
+        from = end;
+    }
+}
+
+// new array - nothing is discarded
+void
+discardreset(void)
+{
+    acquiresleep(&discardlock);
+    memset(bitmap, 0, sizeof(bitmap));
+    for (uint64 k = 0; k < DISCARD_BLOCKS; k++)
+        writebitmap(k);
+    recount();
+    releasesleep(&discardlock);
+}
+
+// layout changed - reshape started or is done
+void
+discardrecount(void)
+{
+    acquiresleep(&discardlock);
+    recount();
+    releasesleep(&discardlock);
+}
+
+// read bitmap on boot - raidmeta must be loaded, with locks of its level
+void
+discardinit(void)
+{
+    initsleeplock(&discardlock, "discardlock");
+
+    for (uint64 k = 0; k < DISCARD_BLOCKS; k++)
+        read_block(1, discardblockn() + k, bitmap + k * BSIZE);
+
+    discardrecount();
+}
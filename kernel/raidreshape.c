@@ -0,0 +1,307 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "raid.h"
+
+// global variable
+extern struct RAIDMeta raidmeta;
+
+uint64 raid5paritydisk(uint64 stripe, uint64 members);
+uint64 raid5datadisk(uint64 stripe, uint64 stripepos, uint64 members);
+
+// Online reshape.
+// RAID0 and RAID5 grow from raidmeta.members to raidmeta.newmembers disks while staying online.
+// raidd moves one row at a time: the blocks that belong to row reshapepos over newmembers disks
+// are read from their old places and written to the row. Rows below reshapepos are in the new
+// layout, the rest is still in the old one - the engines pick the layout by the row (raid0members, raid5members).
+// Moved blocks always come from rows at or after the row they go to, so moving in order never
+// overwrites a block that is not moved yet. Only the first rows can overwrite their own blocks -
+// those go through a backup area, so reboot in the middle of the row does not lose them.
+// Capacity grows when the last row is moved.
+
+static struct spinlock reshapelock;         // protects inflight and moving
+static int inflight;                        // requests in progress on RAID0 or RAID5
+static int moving;                          // reshape step in progress - new requests wait
+
+// blocks of one row - only raidd uses it
+static uchar rowbuf[DISKS][BSIZE];
+
+static int
+canreshapetype(void)
+{
+    return raidmeta.type == RAID0 || raidmeta.type == RAID5;
+}
+
+// request starts - waits while rows are being moved
+void
+raidiobegin(void)
+{
+    if (!canreshapetype())
+        return;
+
+    acquire(&reshapelock);
+    while (moving)
+        sleep(&moving, &reshapelock);
+    inflight++;
+    release(&reshapelock);
+}
+
+// request is done
+void
+raidioend(void)
+{
+    if (!canreshapetype())
+        return;
+
+    acquire(&reshapelock);
+    inflight--;
+    if (inflight == 0)
+        wakeup(&inflight);
+    release(&reshapelock);
+}
+
+// is there a reshape that can move forward - every disk of the new layout must be valid
+int
+canreshape(void)
+{
+    if (raidmeta.isDestroyed || !canreshapetype() || raidmeta.newmembers == raidmeta.members)
+        return 0;
+
+    for (int i = 0; i < raidmeta.newmembers; i++)
+        if (!raidmeta.diskinfo[i].valid)
+            return 0;
+
+    return 1;
+}
+
+// grow RAID0 or RAID5 to disks disks - data is moved in background by raidd
+uint64
+reshaperaid(int disks)
+{
+    if (raidmeta.isDestroyed)
+    {
+        panic("RAID structure was destroyed\n");
+        exit(0);
+    }
+
+    if (!canreshapetype())
+        return -1;
+
+    // one reshape at a time, and disks can only be added
+    if (raidmeta.newmembers != raidmeta.members || disks <= raidmeta.members || disks > DISKS)
+        return -1;
+
+    for (int i = raidmeta.members; i < disks; i++)
+        if (!raidmeta.diskinfo[i].valid)
+            return -1;
+
+    // no row is moved yet, so requests in progress are not affected
+    raidmeta.reshapepos = 0;
+    raidmeta.reshapebackup = -1;
+    raidmeta.newmembers = disks;
+
+    writeraidmeta();
+    discardrecount();
+    raiddwakeup();
+
+    return 0;
+}
+
+// physical disk and block where virtual block was before reshape
+static void
+oldplace(uint64 vblkn, int* disk, uint64* pblkn)
+{
+    uint64 members = raidmeta.members;
+
+    if (raidmeta.type == RAID0)
+    {
+        *disk = raidmeta.diskinfo[vblkn % members].diskn;
+        *pblkn = vblkn / members;
+    }
+    else
+    {
+        uint64 stripe = vblkn / (members - 1);
+        *disk = raidmeta.diskinfo[raid5datadisk(stripe, vblkn % (members - 1), members)].diskn;
+        *pblkn = stripe;
+    }
+}
+
+// move count blocks starting with first into row - all disk locks must be held
+static void
+moverow(uint64 row, uint64 first, uint64 count)
+{
+    int parity = raidmeta.type == RAID5;
+    uint64 olddata = raidmeta.members - parity;
+    uint64 newdata = raidmeta.newmembers - parity;
+
+    // backup area - last blocks of first added disk, the array reaches them only after reshape
+    int backupdisk = raidmeta.diskinfo[raidmeta.members].diskn;
+
+    // row holds blocks of itself only when blocks of old row are not all moved before it
+    int overlap = first / olddata == row;
+
+    if (raidmeta.reshapebackup == row)
+    {
+        // reboot while moving this row - old places may be already overwritten
+        for (uint64 j = 0; j < count; j++)
+            read_block(backupdisk, diskblockn() - 1 - j, rowbuf[j]);
+    }
+    else
+    {
+        for (uint64 j = 0; j < count; j++)
+        {
+            int disk;
+            uint64 pblkn;
+            oldplace(first + j, &disk, &pblkn);
+            read_block(disk, pblkn, rowbuf[j]);
+        }
+
+        if (overlap)
+        {
+            for (uint64 j = 0; j < count; j++)
+                write_block(backupdisk, diskblockn() - 1 - j, rowbuf[j]);
+            raidmeta.reshapebackup = row;
+            writeraidmetaheld();
+        }
+    }
+
+    // blocks after the end of old array have no content yet
+    for (uint64 j = count; j < newdata; j++)
+        memset(rowbuf[j], 0, BSIZE);
+
+    if (parity)
+    {
+        uchar* page = (uchar*)kalloc();
+        for (int i = 0; i < BSIZE; i++)
+            page[i] = 0;
+
+        for (uint64 j = 0; j < newdata; j++)
+        {
+            for (int i = 0; i < BSIZE; i++)
+                page[i] ^= rowbuf[j][i];
+            write_block(raidmeta.diskinfo[raid5datadisk(row, j, raidmeta.newmembers)].diskn, row, rowbuf[j]);
+        }
+        write_block(raidmeta.diskinfo[raid5paritydisk(row, raidmeta.newmembers)].diskn, row, page);
+
+        kfree(page);
+    }
+    else
+    {
+        for (uint64 j = 0; j < newdata; j++)
+            write_block(raidmeta.diskinfo[j].diskn, row, rowbuf[j]);
+    }
+
+    raidmeta.reshapepos = row + 1;
+    raidmeta.reshapebackup = -1;
+}
+
+// every block is moved - rows from row on are left over from old layout
+// all disk locks must be held
+static void
+finishreshape(uint64 row)
+{
+    if (raidmeta.type == RAID5)
+    {
+        struct RAID5Data* raiddata = &raidmeta.data.raid5;
+        uint64 members = raidmeta.newmembers;
+
+        // rest of the last moved cluster gets parity of the new layout, later clusters are loaded again when written
+        // no need for cluster lock - writers wait on reshape
+        uint64 clustern = (row + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+        uint64 end = clustern * CLUSTER_SIZE < diskblockn() ? clustern * CLUSTER_SIZE : diskblockn();
+
+        uchar* page = (uchar*)kalloc();
+        uchar* data = page;
+        uchar* parityblk = page + BSIZE;
+
+        for (uint64 r = row; r < end; r++)
+        {
+            for (int i = 0; i < BSIZE; i++)
+                parityblk[i] = 0;
+
+            for (uint64 j = 0; j < members - 1; j++)
+            {
+                read_block(raidmeta.diskinfo[raid5datadisk(r, j, members)].diskn, r, data);
+                for (int i = 0; i < BSIZE; i++)
+                    parityblk[i] ^= data[i];
+            }
+            write_block(raidmeta.diskinfo[raid5paritydisk(r, members)].diskn, r, parityblk);
+        }
+
+        kfree(page);
+
+        for (uint64 c = clustern; c < NELEM(raiddata->cluster_loaded); c++)
+            raiddata->cluster_loaded[c] = 0;
+    }
+
+    raidmeta.members = raidmeta.newmembers;
+    raidmeta.reshapepos = 0;
+    raidmeta.reshapebackup = -1;
+}
+
+// move next row - called by raidd
+void
+reshapestep(void)
+{
+    // wait for requests in progress, new ones wait for the step
+    acquire(&reshapelock);
+    moving = 1;
+    while (inflight)
+        sleep(&inflight, &reshapelock);
+    release(&reshapelock);
+
+    // acquire every disk lock
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&raidmeta.diskinfo[i].lock);
+
+    // disk could fail since raidd looked
+    int done = 0;
+    if (canreshape())
+    {
+        int parity = raidmeta.type == RAID5;
+        uint64 row = raidmeta.reshapepos;
+        uint64 first = row * (raidmeta.newmembers - parity);
+        uint64 oldblocks = diskblockn() * (raidmeta.members - parity);
+
+        if (first >= oldblocks)
+        {
+            finishreshape(row);
+            done = 1;
+        }
+        else
+        {
+            uint64 count = raidmeta.newmembers - parity;
+            if (count > oldblocks - first)
+                count = oldblocks - first;
+            moverow(row, first, count);
+        }
+
+        // keep watermark on disks, so reshape continues from it after reboot
+        writeraidmetaheld();
+    }
+
+    // release all disk locks
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&raidmeta.diskinfo[i].lock);
+
+    acquire(&reshapelock);
+    moving = 0;
+    wakeup(&moving);
+    release(&reshapelock);
+
+    // discarded blocks are in other clusters of the new layout
+    if (done)
+        discardrecount();
+}
+
+void
+reshapeinit(void)
+{
+    initlock(&reshapelock, "reshapelock");
+    inflight = moving = 0;
+}
@@ -0,0 +1,295 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "raid.h"
+#include "raidstat.h"
+
+// global variable
+extern struct RAIDMeta raidmeta;
+
+int scrubraid4(uint64 row);
+int scrubraid5(uint64 row);
+int scrubraid6(uint64 row);
+int scrubraid5d(uint64 row);
+
+// Background scrub.
+// Parity that drifted from its data, or mirrors that differ, would only show when a disk fails
+// and rebuild uses them. raidd walks the rows of the disks from raidmeta.scrubpos, at most
+// raidmeta.scrubrate rows per tick, and backs off longer while the array is busy. Rows of clusters
+// that were never loaded, or were discarded, have no parity or copy to compare and are skipped. With checksums on, a
+// block that fails its checksum is rebuilt from the rest of its stripe, or copied from the other disk of the mirror -
+// redundancy made to match it would lose it. Any other mismatch is repaired the way md does: parity is computed
+// again from data, and the first disk of a mirror is copied to the second, since nothing tells which copy is right.
+// The cursor is saved in raidmeta, so a pass continues after reboot.
+
+static struct spinlock scrublock;           // protects scrubpos, scrubrate and scrubfound
+
+// does the level keep anything to compare
+static int
+canscrubtype(void)
+{
+    return raidmeta.type != RAID0;
+}
+
+// is there a scrub pass to move forward - every disk valid, no rebuild or reshape
+int
+canscrub(void)
+{
+    if (raidmeta.isDestroyed || !canscrubtype() || raidmeta.scrubrate == 0)
+        return 0;
+    if (raidmeta.rebuilding >= 0 || raidmeta.newmembers != raidmeta.members)
+        return 0;
+
+    for (int i = 0; i < DISKS; i++)
+        if (!raidmeta.diskinfo[i].valid)
+            return 0;
+
+    return 1;
+}
+
+// set rows scrubbed per tick, 0 pauses the pass, -1 only asks - returns the old rate
+// a pass starts at row 0 and stops by itself at the end of the disks
+int
+scrubraid(int rate)
+{
+    if (raidmeta.isDestroyed)
+    {
+        panic("RAID structure was destroyed\n");
+        exit(0);
+    }
+
+    if (!canscrubtype())
+        return -1;
+
+    // a step holds every disk lock, so it must stay short
+    if (rate > CLUSTER_SIZE)
+        rate = CLUSTER_SIZE;
+
+    acquire(&scrublock);
+    int old = raidmeta.scrubrate;
+    if (rate >= 0)
+    {
+        if (raidmeta.scrubpos == 0)
+            raidmeta.scrubfound = 0;
+        raidmeta.scrubrate = rate;
+    }
+    release(&scrublock);
+
+    if (rate >= 0 && rate != old)
+    {
+        writeraidmeta();
+        raiddwakeup();
+    }
+
+    return old;
+}
+
+// rows [from, to) of mirror pair - same locking as rebuild of a mirror
+static int
+scrubmirror(struct DiskPair* diskpair, uint64 from, uint64 to)
+{
+    acquire(&diskpair->mutex);
+    while (diskpair->writing || diskpair->reading[0] || diskpair->reading[1])
+        sleep(&diskpair->mutex, &diskpair->mutex);
+    diskpair->writing = 1;
+    release(&diskpair->mutex);
+
+    for (int i=0; i<2; i++)
+        acquiresleep(&diskpair->disk[i]->lock);
+
+    uchar* page = (uchar*)kalloc();
+    uchar* first = page;
+    uchar* second = page + BSIZE;
+    int found = 0;
+
+    // last disk of odd number of disks has no pair, and a disk could fail before the writers stopped -
+    // they wrote only the other one then
+    int valid = diskpair->disk[0]->valid && diskpair->disk[1]->valid;
+
+    for (uint64 b = from; valid && b < to; b++)
+    {
+        // copies of discarded blocks, and of clusters never written, may differ - they hold nothing
+        if (rowdiscarded(b) || !mirrorloaded(diskpair, b / CLUSTER_SIZE))
+            continue;
+
+        int d0 = diskpair->disk[0]->diskn, d1 = diskpair->disk[1]->diskn;
+        read_block(d0, b, first);
+        read_block(d1, b, second);
+        if (memcmp(first, second, BSIZE) == 0)
+            continue;
+
+        // the copy that passes its checksum is right, and with none known the first one is
+        if (csumcheck(d0, b, first) == 0)
+        {
+            write_block(d1, b, first);
+            found++;
+        }
+        else if (csumcheck(d1, b, second) == 0)
+        {
+            write_block(d0, b, second);
+            found++;
+        }
+    }
+
+    kfree(page);
+
+    for (int i=0; i<2; i++)
+        releasesleep(&diskpair->disk[i]->lock);
+
+    acquire(&diskpair->mutex);
+    diskpair->writing = 0;
+    release(&diskpair->mutex);
+    wakeup(&diskpair->mutex);
+
+    return found;
+}
+
+// stripe of RAID4 or RAID5, or group of RAID5D: block k of its n blocks is blockno[k] of physical disk diskn[k],
+// and block p holds parity. one block that fails its checksum is rebuilt from the rest, written back if the
+// result passes; with more nothing tells what they held. with none, parity is made to match the data.
+// returns blocks written - every disk must be valid, writers stopped and all disk locks held when called
+int
+scrubxor(int* diskn, uint64* blockno, int n, int p)
+{
+    uchar* page = (uchar*)kalloc();
+    uchar* data = page;
+    uchar* sum = page + BSIZE;              // xor of every block - zero when parity matches
+    uchar* parity = page + 2 * BSIZE;
+    uchar* bad = page + 3 * BSIZE;
+
+    memset(sum, 0, BSIZE);
+    int nbad = 0, badk = -1;
+    for (int k = 0; k < n; k++)
+    {
+        read_block(diskn[k], blockno[k], data);
+        if (csumcheck(diskn[k], blockno[k], data) < 0)
+        {
+            nbad++;
+            badk = k;
+            memmove(bad, data, BSIZE);
+        }
+        if (k == p)
+            memmove(parity, data, BSIZE);
+        for (int i = 0; i < BSIZE; i++)
+            sum[i] ^= data[i];
+    }
+
+    int found = 0;
+    if (nbad == 1)
+    {
+        // xor of the other blocks
+        for (int i = 0; i < BSIZE; i++)
+            bad[i] ^= sum[i];
+        if (csumcheck(diskn[badk], blockno[badk], bad) == 0)
+        {
+            write_block(diskn[badk], blockno[badk], bad);
+            found = 1;
+        }
+    }
+    else if (nbad == 0)
+    {
+        for (int i = 0; i < BSIZE; i++)
+            found |= sum[i] != 0;
+        if (found)
+        {
+            for (int i = 0; i < BSIZE; i++)
+                parity[i] ^= sum[i];
+            write_block(diskn[p], blockno[p], parity);
+        }
+    }
+
+    kfree(page);
+    return found;
+}
+
+// rows [from, to) of parity level - writers are stopped meanwhile, as for rebuild
+static int
+scrubparity(uint64 from, uint64 to)
+{
+    int (*scrubrow)(uint64 row);
+    switch (raidmeta.type)
+    {
+        case RAID4:
+            scrubrow = scrubraid4;
+            break;
+        case RAID5:
+            scrubrow = scrubraid5;
+            break;
+        case RAID6:
+            scrubrow = scrubraid6;
+            break;
+        default:
+            scrubrow = scrubraid5d;
+    }
+
+    beginparityrepair();
+
+    // disk could fail since raidd looked
+    int found = 0;
+    if (canscrub())
+        for (uint64 b = from; b < to; b++)
+            found += scrubrow(b);
+
+    endparityrepair();
+
+    return found;
+}
+
+// one step of scrub - called by raidd
+void
+scrubstep(void)
+{
+    acquire(&scrublock);
+    uint64 from = raidmeta.scrubpos;
+    uint64 to = from + raidmeta.scrubrate;
+    release(&scrublock);
+
+    if (to > diskblockn())
+        to = diskblockn();
+
+    int found = 0;
+    switch (raidmeta.type)
+    {
+        case RAID1:
+            for (int i = 0; i < (DISKS + 1) / 2; i++)
+                found += scrubmirror(&raidmeta.data.raid1.diskpair[i], from, to);
+            break;
+        case RAID0_1:
+            for (int i = 0; i < DISKS / 2; i++)
+                found += scrubmirror(&raidmeta.data.raid0_1.diskpair[i], from, to);
+            break;
+        default:
+            found = scrubparity(from, to);
+    }
+
+    for (int i = 0; i < found; i++)
+        raidstat_event(STAT_SCRUBREPAIR);
+
+    acquire(&scrublock);
+    uint64 oldpos = raidmeta.scrubpos;
+    raidmeta.scrubfound += found;
+    raidmeta.scrubpos = to;
+    int done = to >= diskblockn();
+    if (done)
+    {
+        printf("raid: scrub done, %d mismatches repaired\n", (int)raidmeta.scrubfound);
+        raidmeta.scrubpos = 0;
+        raidmeta.scrubrate = 0;
+    }
+    release(&scrublock);
+
+    // keep cursor on disks once per cluster, so a pass continues after reboot
+    if (done || found || oldpos / CLUSTER_SIZE != to / CLUSTER_SIZE)
+        writeraidmeta();
+}
+
+void
+scrubinit(void)
+{
+    initlock(&scrublock, "scrublock");
+}
@@ -0,0 +1,510 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "raid.h"
+
+// global variable
+extern struct RAIDMeta raidmeta;
+
+void repairraid6(int diskn, uint64 from, uint64 to);
+uint64 raid5members(uint64 stripe);
+int sparependingraid5d(void);
+void sparestepraid5d(void);
+
+// Hot spares.
+// When a disk fails, a free hot spare takes its place in diskinfo and raidd (kernel thread)
+// rebuilds it step by step. Blocks below raidmeta.rebuildpos are already rebuilt, so
+// requests use them (blockvalid), and everything above is still served degraded.
+// RAID5D has no hot spares - raidd rebuilds its failed disk into the distributed spare the same way.
+// The disk a spare took the place of goes to the spares, and stands by once its slot is repaired.
+// When there is nothing to rebuild, raidd moves reshape forward (raidreshape.c),
+// and when there is no reshape either, scrub (raidscrub.c).
+
+// blocks rebuilt in one step - between steps requests get the disks
+#define REBUILD_STEP CLUSTER_SIZE
+// ticks to back off after a step during which the array was busy
+#define REBUILD_DELAY 1
+// same for scrub, which can wait much longer
+#define SCRUB_DELAY 10
+
+static struct spinlock rebuildlock;         // protects rebuilding, rebuildpos, rebuildgen and spares
+static struct sleeplock sparelock;          // one spare at a time is put in place of a disk
+static int rebuildgen;                      // changes with every rebuild started or dropped - a step
+                                            // of an older one must not move the watermark
+static int activity;                        // requests to the array, to notice when it is busy
+
+// count request to the array - raidd backs off when it sees new ones
+void
+raidactivity(void)
+{
+    __sync_fetch_and_add(&activity, 1);
+}
+
+// can content of disk be recomputed from the other disks
+static int
+canrebuild(int diskn)
+{
+    struct DiskInfo* diskinfo = raidmeta.diskinfo;
+
+    switch (raidmeta.type)
+    {
+        case RAID1:
+            // last disk of odd number of disks has no pair
+            return (diskn ^ 1) < DISKS && diskinfo[diskn ^ 1].valid;
+        case RAID0_1:
+            return diskn < DISKS / 2 * 2 && diskinfo[(diskn + DISKS / 2) % (DISKS / 2 * 2)].valid;
+        case RAID4:
+        case RAID5:
+        case RAID6:
+        {
+            // disk not yet added by reshape has nothing to rebuild
+            if (diskn >= raidmeta.newmembers)
+                return 0;
+
+            int invalid = 0;
+            for (int i = 0; i < DISKS; i++)
+                if (i != diskn && !diskinfo[i].valid)
+                    invalid++;
+            return invalid < (raidmeta.type == RAID6 ? 2 : 1);
+        }
+        default:
+            // RAID0 has no redundancy, RAID5D rebuilds into its distributed spare
+            return 0;
+    }
+}
+
+// if a disk is invalid and there is a free hot spare, put the spare in its place and wake raidd
+static void
+startrebuild(void)
+{
+    if (raidmeta.isDestroyed)
+        return;
+
+    acquiresleep(&sparelock);
+    acquire(&rebuildlock);
+
+    int disk = -1, spare = 0, s = 0;
+    for (int i = 0; i < DISKS && raidmeta.rebuilding < 0 && disk < 0; i++)
+    {
+        if (raidmeta.diskinfo[i].valid || !canrebuild(i))
+            continue;
+
+        for (s = 0; s < SPARES; s++)
+        {
+            if (raidmeta.spare[s] && !raidmeta.sparefailed[s])
+            {
+                disk = i;
+                spare = raidmeta.spare[s];
+                raidmeta.spare[s] = 0;
+                break;
+            }
+        }
+    }
+
+    release(&rebuildlock);
+
+    if (disk >= 0)
+    {
+        // a step of a dropped rebuild may still work on the slot - it ends on the disk it began with.
+        // raidrepair may have made the disk valid meanwhile, under the same lock - then the spare goes back.
+        // otherwise the failed disk takes its entry, until the slot is repaired (sparerepair)
+        acquiresleep(&raidmeta.diskinfo[disk].lock);
+        acquire(&rebuildlock);
+        if (raidmeta.diskinfo[disk].valid)
+        {
+            raidmeta.spare[s] = spare;
+        }
+        else
+        {
+            raidmeta.spare[s] = raidmeta.diskinfo[disk].diskn;
+            raidmeta.sparefailed[s] = disk + 1;
+            raidmeta.diskinfo[disk].diskn = spare;
+            raidmeta.rebuildpos = 0;
+            raidmeta.rebuilding = disk;
+            rebuildgen++;
+            wakeup(&raidmeta.rebuilding);
+        }
+        release(&rebuildlock);
+        releasesleep(&raidmeta.diskinfo[disk].lock);
+    }
+
+    releasesleep(&sparelock);
+}
+
+// disk failed - if it was the spare being rebuilt, drop that spare, and take a new one if there is any
+void
+sparefail(int diskn)
+{
+    acquire(&rebuildlock);
+    if (raidmeta.rebuilding == diskn)
+    {
+        raidmeta.rebuilding = -1;
+        rebuildgen++;
+    }
+    release(&rebuildlock);
+
+    startrebuild();
+}
+
+// slot diskn is repaired - disks hot spares took its place from are replaced as well, so they stand by again
+// and may go in place of another failed disk
+void
+sparerepair(int diskn)
+{
+    acquire(&rebuildlock);
+    for (int s = 0; s < SPARES; s++)
+        if (raidmeta.sparefailed[s] == diskn + 1)
+            raidmeta.sparefailed[s] = 0;
+    release(&rebuildlock);
+
+    startrebuild();
+    writeraidmeta();
+}
+
+// move watermark after blocks up to to are rebuilt - disk locks of rebuilt disk must be held.
+// gen is rebuildgen when the step began - nothing moves if its rebuild was dropped meanwhile.
+static void
+advancerebuild(int diskn, int gen, uint64 to)
+{
+    acquire(&rebuildlock);
+    if (raidmeta.rebuilding == diskn && rebuildgen == gen)
+    {
+        raidmeta.rebuildpos = to;
+        if (to >= diskblockn())
+        {
+            raidmeta.diskinfo[diskn].valid = 1;
+            raidmeta.rebuilding = -1;
+        }
+    }
+    release(&rebuildlock);
+}
+
+// copy blocks [from, to) from the other disk of the pair
+static void
+rebuildmirror(struct DiskPair* diskpair, int diskn, int gen, uint64 from, uint64 to)
+{
+    struct DiskInfo* target = &raidmeta.diskinfo[diskn];
+    struct DiskInfo* pair = diskpair->disk[diskpair->disk[0] == target ? 1 : 0];
+
+    // same as raidrepair - no readers or writers on the pair while copying
+    acquire(&diskpair->mutex);
+    while (diskpair->writing || diskpair->reading[0] || diskpair->reading[1])
+        sleep(&diskpair->mutex, &diskpair->mutex);
+    diskpair->writing = 1;
+    release(&diskpair->mutex);
+
+    for (int i=0; i<2; i++)
+        acquiresleep(&diskpair->disk[i]->lock);
+
+    copyused(pair->diskn, target->diskn, from, to);
+
+    advancerebuild(diskn, gen, to);
+
+    for (int i=0; i<2; i++)
+        releasesleep(&diskpair->disk[i]->lock);
+
+    acquire(&diskpair->mutex);
+    diskpair->writing = 0;
+    release(&diskpair->mutex);
+    wakeup(&diskpair->mutex);
+}
+
+// repair gate of RAID4, RAID5, RAID6 and RAID5D - writers in progress
+static void
+repairgate(struct spinlock** repairlock, int** writecount, int** repairing)
+{
+    switch (raidmeta.type)
+    {
+        case RAID4:
+        {
+            struct RAID4Data* raiddata = &raidmeta.data.raid4;
+            *repairlock = &raiddata->repairlock;
+            *writecount = &raiddata->writecount;
+            *repairing = &raiddata->repairing;
+            break;
+        }
+        case RAID5:
+        {
+            struct RAID5Data* raiddata = &raidmeta.data.raid5;
+            *repairlock = &raiddata->repairlock;
+            *writecount = &raiddata->writecount;
+            *repairing = &raiddata->repairing;
+            break;
+        }
+        case RAID6:
+        {
+            struct RAID6Data* raiddata = &raidmeta.data.raid6;
+            *repairlock = &raiddata->repairlock;
+            *writecount = &raiddata->writecount;
+            *repairing = &raiddata->repairing;
+            break;
+        }
+        case RAID5D:
+        {
+            struct RAID5DData* raiddata = &raidmeta.data.raid5d;
+            *repairlock = &raiddata->repairlock;
+            *writecount = &raiddata->writecount;
+            *repairing = &raiddata->repairing;
+            break;
+        }
+        default:
+            panic("repairgate");
+    }
+}
+
+// stop writers of a parity level and take every disk lock - rebuild and scrub work under it
+void
+beginparityrepair(void)
+{
+    struct spinlock* repairlock;
+    int* writecount;
+    int* repairing;
+    repairgate(&repairlock, &writecount, &repairing);
+
+    // REPAIR - LOCK -ADD
+    acquire(repairlock);
+    (*repairing)++;
+    while (*writecount != 0 && *repairing != 0)
+    {
+        sleep(writecount, repairlock);
+    }
+    release(repairlock);
+
+    // acquire every disk lock
+    for (int i = 0; i < DISKS; i++)
+        acquiresleep(&raidmeta.diskinfo[i].lock);
+}
+
+void
+endparityrepair(void)
+{
+    struct spinlock* repairlock;
+    int* writecount;
+    int* repairing;
+    repairgate(&repairlock, &writecount, &repairing);
+
+    // release all disk locks
+    for (int i = 0; i < DISKS; i++)
+        releasesleep(&raidmeta.diskinfo[i].lock);
+
+    // REPAIR - LOCK -ADD
+    acquire(repairlock);
+    (*repairing)--;
+    if (*repairing == 0)
+    {
+        wakeup(repairing);
+    }
+    release(repairlock);
+}
+
+// has parity of row been set up by a cluster load - RAID4, RAID5 and RAID6
+static int
+rowloaded(uint64 row)
+{
+    struct sleeplock* clusterlock;
+    uint8* cluster_loaded;
+
+    switch (raidmeta.type)
+    {
+        case RAID4:
+            clusterlock = &raidmeta.data.raid4.clusterlock;
+            cluster_loaded = raidmeta.data.raid4.cluster_loaded;
+            break;
+        case RAID5:
+            clusterlock = &raidmeta.data.raid5.clusterlock;
+            cluster_loaded = raidmeta.data.raid5.cluster_loaded;
+            break;
+        default:
+            clusterlock = &raidmeta.data.raid6.clusterlock;
+            cluster_loaded = raidmeta.data.raid6.cluster_loaded;
+    }
+
+    acquiresleep(clusterlock);
+    int loaded = cluster_loaded[row / CLUSTER_SIZE];
+    releasesleep(clusterlock);
+
+    return loaded;
+}
+
+// recompute blocks [from, to) from the rest of the stripe - RAID4, RAID5 and RAID6
+static void
+rebuildparity(int diskn, int gen, uint64 from, uint64 to)
+{
+    beginparityrepair();
+
+    if (raidmeta.type == RAID6)
+    {
+        repairraid6(diskn, from, to);
+    }
+    else
+    {
+        uchar* newpg = (uchar*)kalloc();
+        uchar* buff = newpg;
+        uchar* parity = newpg + BSIZE;
+
+        for (uint64 b = from; b < to; b++)
+        {
+            // if cluster has not been loaded before, or was discarded since, no need for repair
+            if (!rowloaded(b))
+                continue;
+
+            for (int i = 0; i < BSIZE; i++)
+                parity[i] = 0;
+
+            int members = raidmeta.type == RAID5 ? raid5members(b) : DISKS;
+            for (int i = 0; i < members; i++)
+            {
+                if (i != diskn)
+                {
+                    read_block(raidmeta.diskinfo[i].diskn, b, buff);
+                    for (int j = 0; j < BSIZE; j++)
+                        parity[j] ^= buff[j];
+                }
+            }
+
+            write_block(raidmeta.diskinfo[diskn].diskn, b, parity);
+        }
+
+        kfree(newpg);
+    }
+
+    advancerebuild(diskn, gen, to);
+
+    endparityrepair();
+}
+
+// one step of rebuild gen
+static void
+rebuildstep(int diskn, int gen, uint64 from, uint64 to)
+{
+    // spare holds whatever it held before - nothing below the watermark is read from it yet
+    if (from == 0)
+        csumclear(raidmeta.diskinfo[diskn].diskn);
+
+    switch (raidmeta.type)
+    {
+        case RAID1:
+            rebuildmirror(&raidmeta.data.raid1.diskpair[diskn / 2], diskn, gen, from, to);
+            break;
+        case RAID0_1:
+            rebuildmirror(&raidmeta.data.raid0_1.diskpair[diskn % (DISKS / 2)], diskn, gen, from, to);
+            break;
+        default:
+            rebuildparity(diskn, gen, from, to);
+    }
+}
+
+static void
+sleepticks(uint n)
+{
+    acquire(&tickslock);
+    uint ticks0 = ticks;
+    while (ticks - ticks0 < n)
+        sleep(&ticks, &tickslock);
+    release(&tickslock);
+}
+
+// kernel thread - rebuilds hot spares, reshapes and scrubs, backing off while the array is busy
+static void
+raidd(void)
+{
+    for (;;)
+    {
+        acquire(&rebuildlock);
+        while (raidmeta.rebuilding < 0 && !sparependingraid5d() && !canreshape() && !canscrub())
+            sleep(&raidmeta.rebuilding, &rebuildlock);
+        int diskn = raidmeta.rebuilding;
+        int gen = rebuildgen;
+        uint64 from = raidmeta.rebuildpos;
+        release(&rebuildlock);
+
+        int seen = activity;
+
+        if (diskn < 0 && sparependingraid5d())
+        {
+            sparestepraid5d();
+
+            // keep watermark on disks, so rebuild continues from it after reboot
+            writeraidmeta();
+        }
+        else if (diskn < 0 && canreshape())
+        {
+            // rebuild goes first - reshape needs every disk valid
+            reshapestep();
+        }
+        else if (diskn < 0)
+        {
+            // scrub goes last, its rate is in rows per tick
+            scrubstep();
+            sleepticks(activity != seen ? SCRUB_DELAY : 1);
+            continue;
+        }
+        else
+        {
+            if (!canrebuild(diskn))
+            {
+                // another disk failed meanwhile - leave the disk invalid
+                acquire(&rebuildlock);
+                if (raidmeta.rebuilding == diskn && rebuildgen == gen)
+                {
+                    raidmeta.rebuilding = -1;
+                    rebuildgen++;
+                }
+                release(&rebuildlock);
+                writeraidmeta();
+                continue;
+            }
+
+            uint64 to = from + REBUILD_STEP;
+            if (to > diskblockn())
+                to = diskblockn();
+            rebuildstep(diskn, gen, from, to);
+
+            // keep watermark on disks, so rebuild continues from it after reboot
+            writeraidmeta();
+
+            if (raidmeta.rebuilding < 0)
+            {
+                // done - maybe another disk waits for a spare
+                startrebuild();
+                continue;
+            }
+        }
+
+        if (activity != seen)
+        {
+            sleepticks(REBUILD_DELAY);
+        }
+        else
+        {
+            yield();
+        }
+    }
+}
+
+// something raidd waits for has changed - disk repaired, reshape or scrub started
+void
+raiddwakeup(void)
+{
+    acquire(&rebuildlock);
+    wakeup(&raidmeta.rebuilding);
+    release(&rebuildlock);
+}
+
+// start raidd - raid must be loaded, a rebuild or reshape saved before reboot continues
+void
+raiddinit(void)
+{
+    initlock(&rebuildlock, "rebuildlock");
+    initsleeplock(&sparelock, "sparelock");
+    reshapeinit();
+    scrubinit();
+
+    if (kthread("raidd", raidd) < 0)
+        panic("raiddinit");
+}
@@ -0,0 +1,100 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+#include "fs.h"
+#include "raidstat.h"
+
+// I/O statistics.
+// Counters are per hart, so counting needs no lock and harts do not share cache lines -
+// a hart only has to stay on its copy while counting (push_off).
+// Latency is measured with the time CSR.
+
+static struct RAIDStat stats[NCPU];
+
+static int
+bucket(uint64 cycles)
+{
+    int b = 0;
+    while (cycles > 1 && b < STAT_BUCKETS - 1)
+    {
+        cycles >>= 1;
+        b++;
+    }
+    return b;
+}
+
+// disk request submitted
+void
+raidstat_diskstart(int diskn)
+{
+    push_off();
+    stats[cpuid()].disk[diskn].depth++;
+    pop_off();
+}
+
+// disk request of n blocks completed, start is time it was submitted
+void
+raidstat_diskdone(int diskn, int write, int n, uint64 start)
+{
+    uint64 cycles = r_time() - start;
+
+    push_off();
+    struct DiskStat* s = &stats[cpuid()].disk[diskn];
+    s->depth--;
+    s->ops[write]++;
+    s->bytes[write] += (uint64)n * BSIZE;
+    s->latency[bucket(cycles)]++;
+    pop_off();
+}
+
+// read_raid or write_raid done, start is time it began
+void
+raidstat_array(int write, int failed, uint64 start)
+{
+    uint64 cycles = r_time() - start;
+
+    push_off();
+    struct RAIDStat* s = &stats[cpuid()];
+    s->ops[write]++;
+    if (failed)
+        s->errors++;
+    s->latency[write][bucket(cycles)]++;
+    pop_off();
+}
+
+// count event of the array
+void
+raidstat_event(int event)
+{
+    push_off();
+    stats[cpuid()].events[event]++;
+    pop_off();
+}
+
+// buffer cache lookup found the block, or had to recycle a buffer
+void
+raidstat_bcache(int miss)
+{
+    push_off();
+    stats[cpuid()].bcache[miss]++;
+    pop_off();
+}
+
+// sum of counters of all harts - counters are read while harts count,
+// so the sum is not a snapshot of one moment
+void
+raidstat_sum(struct RAIDStat* sum)
+{
+    uint64* dst = (uint64*)sum;
+    memset(sum, 0, sizeof(*sum));
+
+    for (int c = 0; c < NCPU; c++)
+    {
+        uint64* src = (uint64*)&stats[c];
+        for (int i = 0; i < sizeof(*sum) / sizeof(uint64); i++)
+            dst[i] += src[i];
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef RAIDSTAT_H
+#define RAIDSTAT_H
+
+// I/O statistics of the RAID layer - every hart counts into its own copy,
+// stat_raid sums them. shared with user space (raidstat).
+
+// log2 latency histogram in cycles of the time CSR (10 MHz on qemu virt):
+// bucket i counts requests that took [2^i, 2^(i+1)) cycles, the last one also everything longer
+#define STAT_BUCKETS 24
+
+// events of the array
+enum RAIDSTAT_EVENT {STAT_PARITYREAD, STAT_DEGRADED, STAT_CLUSTERLOAD, STAT_SCRUBREPAIR, STAT_CSUMERROR, STAT_EVENTS};
+
+struct DiskStat
+{
+    uint64 ops[2];                          // completed requests - [0] reads, [1] writes
+    uint64 bytes[2];
+    uint64 depth;                           // requests submitted and not completed - counters of harts wrap, their sum does not
+    uint64 latency[STAT_BUCKETS];           // from submit to completion
+};
+
+struct RAIDStat
+{
+    uint64 ops[2];                          // read_raid and write_raid requests
+    uint64 errors;                          // requests that failed
+    uint64 events[STAT_EVENTS];             // parity reads of writes, reads rebuilt from other disks, lazy cluster loads, scrub repairs, checksum mismatches
+    uint64 latency[2][STAT_BUCKETS];        // of read_raid and write_raid
+    uint64 bcache[2];                       // buffer cache lookups - [0] hits, [1] misses
+    struct DiskStat disk[DISKS + SPARES + 1];   // by virtio number, 0 is the file system disk
+};
+
+#endif //RAIDSTAT_H
@@ -256,7 +256,28 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor Counter-Enable
+static inline void
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
+// counter-enable bit of the time CSR
+#define COUNTEREN_TM (1L << 1)
+
 // machine-mode cycle counter
+#ifdef RAIDHOST
+uint64 r_time(void);    // raidhost/kernel.c - host clock in ticks of TIMEBASE
+#else
 static inline uint64
 r_time()
 {
@@ -264,6 +285,7 @@ r_time()
   asm volatile("csrr %0, time" : "=r" (x) );
   return x;
 }
+#endif
 
 // enable device interrupts
 static inline void
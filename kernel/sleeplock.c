@@ -8,6 +8,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sleeplock.h"
+#include "trace.h"
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -22,11 +23,16 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  int waited = lk->locked;
+  if (waited)
+    trace(TR_LOCKWAIT, tracelock(lk->name));
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  if (waited)
+    trace(TR_LOCKED, tracelock(lk->name));
   release(&lk->lk);
 }
 
@@ -46,6 +46,10 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // let supervisor and user mode read the time CSR, for nanotime().
+  w_mcounteren(r_mcounteren() | COUNTEREN_TM);
+  w_scounteren(r_scounteren() | COUNTEREN_TM);
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -116,6 +116,30 @@ extern uint64 sys_disk_repaired_raid(void);
 extern uint64 sys_info_raid(void);
 // int destroy_raid();
 extern uint64 sys_destroy_raid(void);
+// int init_raid_layout(enum RAID_TYPE raid, int layout);
+extern uint64 sys_init_raid_layout(void);
+// int init_raid_disks(enum RAID_TYPE raid, int disks);
+extern uint64 sys_init_raid_disks(void);
+// int reshape_raid(int disks);
+extern uint64 sys_reshape_raid(void);
+// int iosched_raid(int diskn, int policy);
+extern uint64 sys_iosched_raid(void);
+// int poll_raid(int diskn, int on);
+extern uint64 sys_poll_raid(void);
+// int irq_raid(int diskn, int hart);
+extern uint64 sys_irq_raid(void);
+// int stat_raid(struct RAIDStat* stat);
+extern uint64 sys_stat_raid(void);
+// int trace_raid(int on, struct TraceEvent* events, int n);
+extern uint64 sys_trace_raid(void);
+// uint64 clocktime(void);
+extern uint64 sys_clocktime(void);
+// int scrub_raid(int rate);
+extern uint64 sys_scrub_raid(void);
+// int checksum_raid(int on);
+extern uint64 sys_checksum_raid(void);
+// int discard_raid(int blkn, int count);
+extern uint64 sys_discard_raid(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -147,7 +171,19 @@ static uint64 (*syscalls[])(void) = {
 [SYS_disk_fail_raid]        sys_disk_fail_raid,
 [SYS_disk_repaired_raid]    sys_disk_repaired_raid,
 [SYS_info_raid]             sys_info_raid,
-[SYS_destroy_raid]          sys_destroy_raid
+[SYS_destroy_raid]          sys_destroy_raid,
+[SYS_init_raid_layout]      sys_init_raid_layout,
+[SYS_init_raid_disks]       sys_init_raid_disks,
+[SYS_reshape_raid]          sys_reshape_raid,
+[SYS_iosched_raid]          sys_iosched_raid,
+[SYS_poll_raid]             sys_poll_raid,
+[SYS_irq_raid]              sys_irq_raid,
+[SYS_stat_raid]             sys_stat_raid,
+[SYS_trace_raid]            sys_trace_raid,
+[SYS_clocktime]             sys_clocktime,
+[SYS_scrub_raid]            sys_scrub_raid,
+[SYS_checksum_raid]         sys_checksum_raid,
+[SYS_discard_raid]          sys_discard_raid
 };
 
 void
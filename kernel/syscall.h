@@ -27,6 +27,18 @@
 #define SYS_disk_repaired_raid 26
 #define SYS_info_raid 27
 #define SYS_destroy_raid 28
+#define SYS_init_raid_layout 29
+#define SYS_init_raid_disks 30
+#define SYS_reshape_raid 31
+#define SYS_iosched_raid 32
+#define SYS_poll_raid 33
+#define SYS_irq_raid 34
+#define SYS_stat_raid 35
+#define SYS_trace_raid 36
+#define SYS_clocktime 37
+#define SYS_scrub_raid 38
+#define SYS_checksum_raid 39
+#define SYS_discard_raid 40
 
 
 
@@ -89,3 +89,11 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// nanoseconds since boot, from the time CSR
+uint64
+sys_clocktime(void)
+{
+  uint64 t = r_time();
+  return t / TIMEBASE * 1000000000 + t % TIMEBASE * 1000000000 / TIMEBASE;
+}
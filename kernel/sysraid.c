@@ -10,21 +10,176 @@
 #include "file.h"
 #include "fcntl.h"
 #include "raid.h"
+#include "iosched.h"
+#include "raidstat.h"
+
+// file system lives on the array - it must not be set up again, destroyed, reshaped,
+// discarded or written around the buffer cache under it
+static int
+rootonraid(void)
+{
+    return ROOTDEV == RAIDDEV;
+}
 
 uint64
 sys_init_raid(void)
 {
     int type;
     argint(0, &type);
-    if (type < 0)
+    if (type < 0 || rootonraid())
     {
         return -1;
     }
 
-    setraidtype(type);
+    setraidtype(type, 0, DISKS);
     return 0;
 }
 
+uint64
+sys_init_raid_layout(void)
+{
+    int type, layout;
+    argint(0, &type);
+    argint(1, &layout);
+    if (type < RAID0 || type > RAID5D || rootonraid())
+        return -1;
+
+    return setraidtype(type, layout, DISKS);
+}
+
+uint64
+sys_init_raid_disks(void)
+{
+    int type, disks;
+    argint(0, &type);
+    argint(1, &disks);
+    if (type < RAID0 || type > RAID5D || rootonraid())
+        return -1;
+
+    return setraidtype(type, 0, disks);
+}
+
+// policy of disk scheduler, -1 only asks - returns the old one
+uint64
+sys_iosched_raid(void)
+{
+    int diskn, policy;
+    argint(0, &diskn);
+    argint(1, &policy);
+    if (diskn < VIRTIO_RAID_DISK_START || diskn > VIRTIO_RAID_DISK_END)
+        return -1;
+    if (policy < -1 || policy > IOSCHED_DEADLINE)
+        return -1;
+
+    return iosched_policy(diskn, policy);
+}
+
+uint64
+sys_poll_raid(void)
+{
+    int diskn, on;
+    argint(0, &diskn);
+    argint(1, &on);
+    if (diskn < VIRTIO_RAID_DISK_START || diskn > VIRTIO_RAID_DISK_END)
+        return -1;
+    if (on < -1 || on > 1)
+        return -1;
+
+    return virtio_disk_poll(diskn, on);
+}
+
+uint64
+sys_irq_raid(void)
+{
+    int diskn, hart;
+    argint(0, &diskn);
+    argint(1, &hart);
+    if (diskn < VIRTIO_RAID_DISK_START || diskn > VIRTIO_RAID_DISK_END)
+        return -1;
+    if (hart < IRQ_SUBMITTER || hart >= NCPU)
+        return -1;
+
+    return plic_affinity(diskn, hart);
+}
+
+// statistics summed over harts
+uint64
+sys_stat_raid(void)
+{
+    uint64 stat_addr;
+    argaddr(0, &stat_addr);
+
+    // too big for kernel stack
+    struct RAIDStat* stat = (struct RAIDStat*)kalloc();
+    if (stat == 0)
+        return -1;
+    raidstat_sum(stat);
+
+    int ret = copyout(myproc()->pagetable, stat_addr, (char*)stat, sizeof(*stat));
+    kfree(stat);
+    return ret < 0 ? -1 : 0;
+}
+
+// tracing on or off (-1 leaves it), then drain at most n events
+uint64
+sys_trace_raid(void)
+{
+    int on, n;
+    uint64 events_addr;
+    argint(0, &on);
+    argaddr(1, &events_addr);
+    argint(2, &n);
+    if (on < -1 || on > 1 || n < 0)
+        return -1;
+
+    return tracedrain(on, events_addr, n);
+}
+
+uint64
+sys_reshape_raid(void)
+{
+    int disks;
+    argint(0, &disks);
+    if (rootonraid())
+        return -1;
+
+    return reshaperaid(disks);
+}
+
+uint64
+sys_scrub_raid(void)
+{
+    int rate;
+    argint(0, &rate);
+    if (rate < -1)
+        return -1;
+
+    return scrubraid(rate);
+}
+
+uint64
+sys_checksum_raid(void)
+{
+    int on;
+    argint(0, &on);
+    if (on < -1 || on > 1)
+        return -1;
+
+    return checksumraid(on);
+}
+
+uint64
+sys_discard_raid(void)
+{
+    int blkn, count;
+    argint(0, &blkn);
+    argint(1, &count);
+    if (blkn < 0 || count < 0 || rootonraid())
+        return -1;
+
+    return discardraid(blkn, count);
+}
+
 uint64
 sys_read_raid(void)
 {
@@ -58,7 +213,7 @@ sys_write_raid(void) {
     int vblkn;
     argint(0, &vblkn);
 
-    if (vblkn < 0 || vblkn >= raidblockn())
+    if (vblkn < 0 || vblkn >= raidblockn() || rootonraid())
         return -1;
 
     struct proc *p = myproc();
@@ -132,6 +287,8 @@ sys_info_raid(void)
 uint64
 sys_destroy_raid(void)
 {
+    if (rootonraid())
+        return -1;
     return raiddestroy();
 }
 
@@ -0,0 +1,173 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "trace.h"
+
+// Trace rings.
+// Only its own hart writes a ring, with interrupts off, so recording takes no lock:
+// the event is written first and then published by moving head. trace_raid reads
+// events up to head and then frees them by moving tail. A full ring drops new events.
+
+// events in ring of one hart - power of two
+#define TRACE_SIZE 1024
+
+static struct TraceRing
+{
+    struct TraceEvent ev[TRACE_SIZE];
+    uint64 head;                // next event written
+    uint64 tail;                // next event drained
+    uint64 dropped;
+} rings[NCPU];
+
+static int tracing;                     // recording is on
+static uint32 nextreq;                  // number of last RAID request
+static struct spinlock drainlock;       // one drain at a time
+
+void
+traceinit(void)
+{
+    initlock(&drainlock, "trace");
+}
+
+// record event for RAID request req
+void
+tracefor(uint32 req, int event, int disk, uint64 arg)
+{
+    if (!tracing || req == 0)
+        return;
+
+    push_off();
+    int c = cpuid();
+    struct TraceRing* r = &rings[c];
+    if (r->head - *(volatile uint64*)&r->tail >= TRACE_SIZE)
+    {
+        __sync_fetch_and_add(&r->dropped, 1);
+    }
+    else
+    {
+        struct TraceEvent* e = &r->ev[r->head % TRACE_SIZE];
+        e->time = r_time();
+        e->req = req;
+        e->event = event;
+        e->cpu = c;
+        e->disk = disk;
+        e->arg = arg;
+        __sync_synchronize();
+        r->head++;
+    }
+    pop_off();
+}
+
+// RAID request the current process works for, 0 if none
+uint32
+tracereq(void)
+{
+    struct proc* p = myproc();
+    return p ? p->tracereq : 0;
+}
+
+// record event for the request of the current process
+void
+trace(int event, uint64 arg)
+{
+    tracefor(tracereq(), event, 0, arg);
+}
+
+// read_raid or write_raid starts - it gets a number, and events of the process belong to it
+void
+tracebegin(int write)
+{
+    if (!tracing)
+        return;
+
+    myproc()->tracereq = __sync_add_and_fetch(&nextreq, 1);
+    trace(TR_START, write);
+}
+
+void
+traceend(int failed)
+{
+    trace(TR_DONE, failed);
+    myproc()->tracereq = 0;
+}
+
+// class of a sleeplock for TR_LOCKWAIT
+int
+tracelock(char* name)
+{
+    if (strncmp(name, "diskinfolock", 16) == 0)
+        return TL_DISK;
+    if (strncmp(name, "clusterlock", 16) == 0)
+        return TL_CLUSTER;
+    if (strncmp(name, "transfer_buffer", 16) == 0)
+        return TL_TRANSFER;
+    return TL_OTHER;
+}
+
+// copy events of ring to user address dst, at most n. drainlock must be held.
+static int
+drainring(struct TraceRing* r, uint64 dst, int n)
+{
+    pagetable_t pagetable = myproc()->pagetable;
+    int copied = 0;
+
+    if (r->dropped && n > 0)
+    {
+        struct TraceEvent e = {r_time(), 0, TR_DROPPED, r - rings, 0, __sync_lock_test_and_set(&r->dropped, 0)};
+        if (copyout(pagetable, dst, (char*)&e, sizeof(e)) < 0)
+            return -1;
+        copied++;
+    }
+
+    uint64 head = *(volatile uint64*)&r->head;
+    __sync_synchronize();
+
+    while (r->tail != head && copied < n)
+    {
+        // to the end of the ring at most
+        uint64 i = r->tail % TRACE_SIZE;
+        uint64 m = head - r->tail;
+        if (m > TRACE_SIZE - i)
+            m = TRACE_SIZE - i;
+        if (m > n - copied)
+            m = n - copied;
+
+        if (copyout(pagetable, dst + copied * sizeof(struct TraceEvent), (char*)&r->ev[i], m * sizeof(struct TraceEvent)) < 0)
+            return -1;
+
+        __sync_synchronize();
+        r->tail += m;
+        copied += m;
+    }
+
+    return copied;
+}
+
+// recording on or off (on < 0 leaves it), then move at most n events to user address dst.
+// returns number of events, -1 on error.
+int
+tracedrain(int on, uint64 dst, int n)
+{
+    if (on >= 0)
+        tracing = on;
+
+    int copied = 0;
+    acquire(&drainlock);
+    for (int c = 0; c < NCPU && copied < n; c++)
+    {
+        int m = drainring(&rings[c], dst + copied * sizeof(struct TraceEvent), n - copied);
+        if (m < 0)
+        {
+            copied = -1;
+            break;
+        }
+        copied += m;
+    }
+    release(&drainlock);
+
+    return copied;
+}
@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Trace of RAID requests - every hart records timestamped events of the
+// request it works for into its own ring, trace_raid drains the rings.
+// shared with user space (raidtrace) and the host decoder (tracedec).
+
+// events - the ones that start a phase are followed by the one that ends it
+enum TRACE_EVENT
+{
+    TR_START,           // read_raid or write_raid - arg 0 read, 1 write
+    TR_DONE,            // arg 0 ok, 1 failed
+    TR_LOCKWAIT,        // sleeplock is held by someone else - arg enum TRACE_LOCK
+    TR_LOCKED,          // got it
+    TR_GATEWAIT,        // writer waits for repair or reshape
+    TR_GATEPASS,        // writer goes on
+    TR_CLUSTERLOAD,     // lazy parity init of cluster arg
+    TR_CLUSTERDONE,
+    TR_PARITY,          // parity update computed
+    TR_PARITYDONE,
+    TR_SUBMIT,          // disk request to scheduler - disk, arg block
+    TR_ISSUE,           // given to the device
+    TR_COMPLETE,        // device is done
+    TR_DROPPED,         // ring of the hart was full, arg events lost
+    TR_EVENTS
+};
+
+// sleeplocks by name
+enum TRACE_LOCK {TL_OTHER, TL_DISK, TL_CLUSTER, TL_TRANSFER};
+
+struct TraceEvent
+{
+    uint64 time;        // time CSR
+    uint32 req;         // RAID request, numbered from 1
+    uint8 event;        // enum TRACE_EVENT
+    uint8 cpu;
+    uint16 disk;        // virtio number of disk events
+    uint64 arg;
+};
+
+#endif //TRACE_H
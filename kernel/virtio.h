@@ -29,6 +29,11 @@
 #define VIRTIO_MMIO_DRIVER_DESC_HIGH	0x094
 #define VIRTIO_MMIO_DEVICE_DESC_LOW	0x0a0 // physical address for used ring, write-only
 #define VIRTIO_MMIO_DEVICE_DESC_HIGH	0x0a4
+#define VIRTIO_MMIO_CONFIG		0x100 // device-specific configuration space
+
+// struct virtio_blk_config, from the spec
+#define VIRTIO_BLK_CONFIG_NUM_QUEUES	0x22 // uint16, with VIRTIO_BLK_F_MQ
+#define VIRTIO_BLK_CONFIG_MAX_DISCARD_SECTORS	0x24 // uint32, with VIRTIO_BLK_F_DISCARD
 
 // status register bits, from qemu virtio_config.h
 #define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
@@ -41,6 +46,7 @@
 #define VIRTIO_BLK_F_SCSI            7	/* Supports scsi command passthru */
 #define VIRTIO_BLK_F_CONFIG_WCE     11	/* Writeback mode available in config */
 #define VIRTIO_BLK_F_MQ             12	/* support more than one vq */
+#define VIRTIO_BLK_F_DISCARD        13	/* DISCARD is supported */
 #define VIRTIO_F_ANY_LAYOUT         27
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
@@ -58,13 +64,18 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr is a table of descriptors
+
+// descriptors in the indirect table of one ring descriptor -
+// the tables of a disk fill one page.
+#define NDESCTABLE (PGSIZE / NUM / sizeof(struct virtq_desc))
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
   uint16 flags; // always zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // with EVENT_IDX: interrupt when device passes this used index
 };
 
 // one entry in the "used" ring, with which the
@@ -78,13 +89,25 @@ struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // with EVENT_IDX: notify when driver passes this avail index
 };
 
+// with EVENT_IDX, completions the driver waits for before asking for an interrupt
+#define INTR_BATCH 4
+
+// how long a polling waiter spins on the used ring before it sleeps,
+// in cycles of the time CSR (10 MHz on qemu virt) - 100 us
+#define POLL_TIME 1000
+
+// has idx passed event when going from old to new (from the spec)
+#define VRING_NEED_EVENT(event, new, old) ((uint16)((new) - (event) - 1) < (uint16)((new) - (old)))
+
 // these are specific to virtio block devices, e.g. disks,
 // described in Section 5.2 of the spec.
 
 #define VIRTIO_BLK_T_IN  0 // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
+#define VIRTIO_BLK_T_DISCARD 11 // blocks hold nothing any more
 
 // the format of the first descriptor in a disk request.
 // to be followed by two more descriptors containing
@@ -94,3 +117,10 @@ struct virtio_blk_req {
   uint32 reserved;
   uint64 sector;
 };
+
+// the one data descriptor of a discard request.
+struct virtio_blk_discard {
+  uint64 sector;
+  uint32 num_sectors;
+  uint32 flags;
+};
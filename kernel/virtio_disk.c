@@ -15,6 +15,8 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "iosched.h"
+#include "trace.h"
 #include "raid.h"
 
 // global variable
@@ -23,10 +25,9 @@ extern struct RAIDMeta raidmeta;
 // the address of virtio mmio register r.
 #define R(offset,r) ((volatile uint32 *)(VIRTIO0 + VIRTIO_OFFSET * offset + (r)))
 
-static struct disk {
-  // Name of the disk to be used with panic and spinlock
-  char *name;
-
+// one virtqueue of a disk. with VIRTIO_BLK_F_MQ every hart submits
+// to a queue of its own, so harts do not contend on one lock.
+struct vqueue {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
@@ -53,26 +54,118 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct ioreq *r;
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
-  
-  struct spinlock vdisk_lock;
-  
+
+  // ranges of discard requests, one-for-one with descriptors too.
+  struct virtio_blk_discard discard[NUM];
+
+  // with indirect descriptors, table of NDESCTABLE descriptors per ring descriptor
+  struct virtq_desc *itable;
+
+  int inflight;    // requests given to the device and not yet in used ring
+  int descwait;    // submitters sleep for free descriptors
+
+  struct spinlock lock;
+};
+
+static struct disk {
+  // Name of the disk to be used with panic and spinlock
+  char *name;
+
+  // with VIRTIO_RING_F_INDIRECT_DESC a request takes one ring descriptor,
+  // which points to its own table of NDESCTABLE descriptors.
+  int indirect;
+
+  // with VIRTIO_RING_F_EVENT_IDX the device is notified only when it asks
+  // for it, and interrupts only after the completions the driver asks for.
+  int eventidx;
+
+  // waiters spin on the used ring before sleeping - for every request of the disk
+  int poll;
+
+  // with VIRTIO_BLK_F_DISCARD blocks can be given back, at most maxdiscard at a time
+  int discard;
+  uint maxdiscard;
+
+  int nqueue;      // virtqueues in use, at most one per hart
+  struct vqueue vq[NCPU];
+
 } disk[VIRTIO_RAID_DISK_END + 1];
 
 static struct buf* transfer_buffer[VIRTIO_RAID_DISK_END + 1];
 
+// set up virtqueue q of disk id
+static void
+virtio_disk_initqueue(int id, int q)
+{
+  struct vqueue *vq = &disk[id].vq[q];
+  char *name = disk[id].name;
+
+  initlock(&vq->lock, name);
+  vq->used_idx = 0;
+  vq->inflight = 0;
+  vq->descwait = 0;
+
+  *R(id, VIRTIO_MMIO_QUEUE_SEL) = q;
+
+  // ensure queue is not in use.
+  if(*R(id, VIRTIO_MMIO_QUEUE_READY))
+      panic_concat(2, name, ": virtio disk should not be ready");
+
+  // check maximum queue size.
+  uint32 max = *R(id, VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if(max == 0)
+      panic_concat(2, name, ": virtio disk has no queue");
+  if(max < NUM)
+      panic_concat(2, name, ": virtio disk max queue too short");
+
+  // allocate and zero queue memory.
+  vq->desc = kalloc();
+  vq->avail = kalloc();
+  vq->used = kalloc();
+  if(!vq->desc || !vq->avail || !vq->used)
+      panic_concat(2, name, ": virtio disk kalloc");
+  memset(vq->desc, 0, PGSIZE);
+  memset(vq->avail, 0, PGSIZE);
+  memset(vq->used, 0, PGSIZE);
+
+  if(disk[id].indirect){
+    vq->itable = kalloc();
+    if(!vq->itable)
+      panic_concat(2, name, ": virtio disk kalloc");
+    memset(vq->itable, 0, PGSIZE);
+  }
+
+  // set queue size.
+  *R(id, VIRTIO_MMIO_QUEUE_NUM) = NUM;
+
+  // write physical addresses.
+  *R(id, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)vq->desc;
+  *R(id, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)vq->desc >> 32;
+  *R(id, VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)vq->avail;
+  *R(id, VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)vq->avail >> 32;
+  *R(id, VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)vq->used;
+  *R(id, VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)vq->used >> 32;
+
+  // queue is ready.
+  *R(id, VIRTIO_MMIO_QUEUE_READY) = 0x1;
+
+  // all NUM descriptors start out unused.
+  for(int i = 0; i < NUM; i++)
+    vq->free[i] = 1;
+}
+
 void
 virtio_disk_init(int id, char * name)
 {
   uint32 status = 0;
 
-  initlock(&disk[id].vdisk_lock, name);
   disk[id].name = name;
 
   if(*R(id, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
@@ -98,11 +191,23 @@ virtio_disk_init(int id, char * name)
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(id, VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk[id].indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
+  disk[id].eventidx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
+  disk[id].poll = 0;
+
+  // a queue per hart, if the device has that many
+  disk[id].nqueue = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ)){
+    int n = *R(id, VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_NUM_QUEUES - 2) >> 16;
+    disk[id].nqueue = n < 1 ? 1 : n > NCPU ? NCPU : n;
+  }
+
+  disk[id].maxdiscard = 0;
+  if(features & (1 << VIRTIO_BLK_F_DISCARD))
+    disk[id].maxdiscard = *R(id, VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_MAX_DISCARD_SECTORS) / (BSIZE / 512);
+  disk[id].discard = disk[id].maxdiscard > 0;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -113,47 +218,8 @@ virtio_disk_init(int id, char * name)
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
       panic_concat(2, name, ": virtio disk FEATURES_OK unset");
 
-  // initialize queue 0.
-  *R(id, VIRTIO_MMIO_QUEUE_SEL) = 0;
-
-  // ensure queue 0 is not in use.
-  if(*R(id, VIRTIO_MMIO_QUEUE_READY))
-      panic_concat(2, name, ": virtio disk should not be ready");
-
-  // check maximum queue size.
-  uint32 max = *R(id, VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-      panic_concat(2, name, ": virtio disk has no queue 0");
-  if(max < NUM)
-      panic_concat(2, name, ": virtio disk max queue too short");
-
-  // allocate and zero queue memory.
-  disk[id].desc = kalloc();
-  disk[id].avail = kalloc();
-  disk[id].used = kalloc();
-  if(!disk[id].desc || !disk[id].avail || !disk[id].used)
-      panic_concat(2, name, ": virtio disk kalloc");
-  memset(disk[id].desc, 0, PGSIZE);
-  memset(disk[id].avail, 0, PGSIZE);
-  memset(disk[id].used, 0, PGSIZE);
-
-  // set queue size.
-  *R(id, VIRTIO_MMIO_QUEUE_NUM) = NUM;
-
-  // write physical addresses.
-  *R(id, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk[id].desc;
-  *R(id, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk[id].desc >> 32;
-  *R(id, VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk[id].avail;
-  *R(id, VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk[id].avail >> 32;
-  *R(id, VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk[id].used;
-  *R(id, VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk[id].used >> 32;
-
-  // queue is ready.
-  *R(id, VIRTIO_MMIO_QUEUE_READY) = 0x1;
-
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
-    disk[id].free[i] = 1;
+  for(int q = 0; q < disk[id].nqueue; q++)
+    virtio_disk_initqueue(id, q);
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -165,19 +231,23 @@ virtio_disk_init(int id, char * name)
       panic("virtio_disk_init: kalloc of transfer_buffer failed");
     }
     memset(transfer_buffer[id], 0, BSIZE);
+    // data follows the buf in the same page
+    transfer_buffer[id]->data = (uchar*)(transfer_buffer[id] + 1);
     initsleeplock(&transfer_buffer[id]->lock, "transfer_buffer");
   }
 
+  iosched_init(id);
+
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ and VIRTIO1_IRQ.
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc(int id)
+alloc_desc(struct vqueue *vq)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk[id].free[i]){
-      disk[id].free[i] = 0;
+    if(vq->free[i]){
+      vq->free[i] = 0;
       return i;
     }
   }
@@ -186,29 +256,27 @@ alloc_desc(int id)
 
 // mark a descriptor as free.
 static void
-free_desc(int id, int i)
+free_desc(int id, struct vqueue *vq, int i)
 {
   if(i >= NUM)
     panic_concat(2, disk[id].name, ": free_desc 1");
-  if(disk[id].free[i])
+  if(vq->free[i])
       panic_concat(2, disk[id].name, ": free_desc 2");
-  disk[id].desc[i].addr = 0;
-  disk[id].desc[i].len = 0;
-  disk[id].desc[i].flags = 0;
-  disk[id].desc[i].next = 0;
-  disk[id].free[i] = 1;
-
-  wakeup(&disk[id].free[0]);
+  vq->desc[i].addr = 0;
+  vq->desc[i].len = 0;
+  vq->desc[i].flags = 0;
+  vq->desc[i].next = 0;
+  vq->free[i] = 1;
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int id, int i)
+free_chain(int id, struct vqueue *vq, int i)
 {
   while(1){
-    int flag = disk[id].desc[i].flags;
-    int nxt = disk[id].desc[i].next;
-    free_desc(id, i);
+    int flag = vq->desc[i].flags;
+    int nxt = vq->desc[i].next;
+    free_desc(id, vq, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -216,98 +284,377 @@ free_chain(int id, int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// number of free descriptors.
 static int
-alloc3_desc(int id, int *idx)
+count_desc(struct vqueue *vq)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc(id);
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(id, idx[j]);
-      return -1;
-    }
-  }
-  return 0;
+  int n = 0;
+  for(int i = 0; i < NUM; i++)
+    if(vq->free[i])
+      n++;
+  return n;
 }
 
-void
-virtio_disk_rw(int id, struct buf *b, int write)
+// with EVENT_IDX ask for an interrupt after INTR_BATCH completions, or
+// after all of them if fewer are in flight - there is always a completion
+// left to raise it.
+static void
+set_used_event(int id, struct vqueue *vq)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  if(!disk[id].eventidx)
+    return;
 
-  acquire(&disk[id].vdisk_lock);
+  int batch = vq->inflight < INTR_BATCH ? vq->inflight : INTR_BATCH;
+  vq->avail->used_event = vq->used_idx + (batch > 0 ? batch - 1 : 0);
+}
 
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+// data segments for a chain of room descriptors - as many requests
+// as fit, returns how many.
+static int
+virtio_disk_segments(struct ioreq **r, int n, int room, uint64 *segaddr, uint32 *seglen, int *segs)
+{
+  int k;
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(id, idx) == 0) {
+  *segs = 0;
+  for(k = 0; k < n; k++){
+    if(*segs > 0 && r[k]->data == r[k-1]->data + r[k-1]->n * BSIZE){
+      seglen[*segs-1] += r[k]->n * BSIZE;
+      continue;
+    }
+    if(*segs == room || *segs == NUM)
       break;
+    segaddr[*segs] = (uint64) r[k]->data;
+    seglen[*segs] = r[k]->n * BSIZE;
+    (*segs)++;
+  }
+  return k;
+}
+
+// start requests for consecutive blocks, all reads or all writes, as one
+// virtio request on the queue of this hart: a descriptor for
+// type/reserved/sector, descriptors for the data, and one for a 1-byte
+// status result. data of requests that follow each other in memory share
+// a descriptor. with indirect descriptors the chain is in the table of
+// the one ring descriptor used. tells the device once. returns how many
+// requests were started - the rest must wait for free descriptors, or,
+// with wait, sleeps until there is room for at least one.
+int
+virtio_disk_start(int id, struct ioreq **r, int n, int wait)
+{
+  push_off();
+  int q = cpuid() % disk[id].nqueue;
+  if(id >= VIRTIO_RAID_DISK_START)
+    plic_steer(id);
+  pop_off();
+  struct vqueue *vq = &disk[id].vq[q];
+
+  acquire(&vq->lock);
+
+  uint64 segaddr[NUM];
+  uint32 seglen[NUM];
+  int segs, k;
+  for(;;){
+    int free = count_desc(vq);
+    int room = disk[id].indirect ? (free > 0 ? NDESCTABLE - 2 : 0) : free - 2;
+
+    // data segments - take as many requests as there are descriptors for.
+    // a discard has one, its range, and is never merged.
+    if(r[0]->discard){
+      segs = 1;
+      k = room > 0;
+    } else
+      k = virtio_disk_segments(r, n, room, segaddr, seglen, &segs);
+    if(k > 0)
+      break;
+
+    if(!wait){
+      release(&vq->lock);
+      return 0;
     }
+    vq->descwait = 1;
+    sleep(&vq->free[0], &vq->lock);
+  }
 
-    sleep(&disk[id].free[0], &disk[id].vdisk_lock);
+  int head = alloc_desc(vq);
+
+  // descriptors of the chain - ring descriptors, or the indirect table
+  struct virtq_desc *d;
+  int idx[NUM + 2];
+  if(disk[id].indirect){
+    d = &vq->itable[head * NDESCTABLE];
+    for(int i = 0; i < segs + 2; i++)
+      idx[i] = i;
+  } else {
+    d = vq->desc;
+    idx[0] = head;
+    for(int i = 1; i < segs + 2; i++)
+      idx[i] = alloc_desc(vq);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk[id].ops[idx[0]];
+  struct virtio_blk_req *buf0 = &vq->ops[head];
 
-  if(write)
+  if(r[0]->discard)
+    buf0->type = VIRTIO_BLK_T_DISCARD; // drop the blocks
+  else if(r[0]->write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
-  buf0->sector = sector;
+  buf0->sector = (uint64)r[0]->blockno * (BSIZE / 512);
+
+  if(r[0]->discard){
+    struct virtio_blk_discard *seg = &vq->discard[head];
+    seg->sector = buf0->sector;
+    seg->num_sectors = r[0]->n * (BSIZE / 512);
+    seg->flags = 0;
+    buf0->sector = 0; // the range is in the segment
+    segaddr[0] = (uint64) seg;
+    seglen[0] = sizeof(struct virtio_blk_discard);
+  }
 
-  disk[id].desc[idx[0]].addr = (uint64) buf0;
-  disk[id].desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk[id].desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk[id].desc[idx[0]].next = idx[1];
+  d[idx[0]].addr = (uint64) buf0;
+  d[idx[0]].len = sizeof(struct virtio_blk_req);
+  d[idx[0]].flags = VRING_DESC_F_NEXT;
+  d[idx[0]].next = idx[1];
 
-  disk[id].desc[idx[1]].addr = (uint64) b->data;
-  disk[id].desc[idx[1]].len = BSIZE;
-  if(write)
-    disk[id].desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk[id].desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk[id].desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk[id].desc[idx[1]].next = idx[2];
+  for(int i = 1; i <= segs; i++){
+    d[idx[i]].addr = segaddr[i-1];
+    d[idx[i]].len = seglen[i-1];
+    if(r[0]->write)
+      d[idx[i]].flags = 0; // device reads data
+    else
+      d[idx[i]].flags = VRING_DESC_F_WRITE; // device writes data
+    d[idx[i]].flags |= VRING_DESC_F_NEXT;
+    d[idx[i]].next = idx[i+1];
+  }
 
-  disk[id].info[idx[0]].status = 0xff; // device writes 0 on success
-  disk[id].desc[idx[2]].addr = (uint64) &disk[id].info[idx[0]].status;
-  disk[id].desc[idx[2]].len = 1;
-  disk[id].desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk[id].desc[idx[2]].next = 0;
+  int status = idx[segs+1];
+  vq->info[head].status = 0xff; // device writes 0 on success
+  d[status].addr = (uint64) &vq->info[head].status;
+  d[status].len = 1;
+  d[status].flags = VRING_DESC_F_WRITE; // device writes the status
+  d[status].next = 0;
+
+  if(disk[id].indirect){
+    vq->desc[head].addr = (uint64) d;
+    vq->desc[head].len = (segs + 2) * sizeof(struct virtq_desc);
+    vq->desc[head].flags = VRING_DESC_F_INDIRECT;
+    vq->desc[head].next = 0;
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk[id].info[idx[0]].b = b;
+  // record requests for virtio_disk_intr() - the first one owns the chain.
+  for(int i = 0; i < k; i++){
+    r[i]->desc = i == 0 ? head : -1;
+    r[i]->queue = q;
+    tracefor(r[i]->trace, TR_ISSUE, id, r[i]->blockno);
+    r[i]->next = i + 1 < k ? r[i+1] : 0;
+  }
+  vq->info[head].r = r[0];
 
   // tell the device the first index in our chain of descriptors.
-  disk[id].avail->ring[disk[id].avail->idx % NUM] = idx[0];
+  vq->avail->ring[vq->avail->idx % NUM] = head;
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk[id].avail->idx += 1; // not % NUM ...
+  uint16 old = vq->avail->idx;
+  vq->avail->idx += 1; // not % NUM ...
+  vq->inflight++;
+  set_used_event(id, vq);
 
   __sync_synchronize();
 
-  *R(id, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  // the device asks to be notified only when it stopped looking at the ring
+  if(!disk[id].eventidx || VRING_NEED_EVENT(vq->used->avail_event, vq->avail->idx, old))
+    *R(id, VIRTIO_MMIO_QUEUE_NOTIFY) = q; // value is queue number
+
+  release(&vq->lock);
+
+  return k;
+}
+
+// complete requests the device put in the used ring of the queue, all of
+// them in one pass: free their descriptors, run their callbacks, and wake
+// up only waiters that sleep - the rest see done without taking the lock
+// of the queue again.
+// vq->lock must be held.
+static void
+virtio_disk_harvest(int id, struct vqueue *vq)
+{
+  int freed = 0;
+
+  do {
+    while(vq->used_idx != vq->used->idx){
+      __sync_synchronize();
+      int idx = vq->used->ring[vq->used_idx % NUM].id;
+
+      if(vq->info[idx].status != 0)
+        panic_concat(2, disk[id].name, ": virtio_disk_intr status");
+
+      struct ioreq *r = vq->info[idx].r;
+      vq->info[idx].r = 0;
+      free_chain(id, vq, idx);
+      freed = 1;
+
+      // every request of the chain is done.
+      // the waiter may return as soon as done is set - nothing of r is used after it.
+      struct ioreq *next;
+      for(; r; r = next){
+        next = r->next;
+        if(r->callback)
+          r->callback(r);
+        raidstat_diskdone(id, r->write, r->discard ? 0 : r->n, r->start); // a discard moves no bytes
+        tracefor(r->trace, TR_COMPLETE, id, r->blockno);
+        int waiting = r->waiting;
+        __sync_synchronize();
+        r->done = 1;   // disk is done with request
+        if(waiting)
+          wakeup(r);
+      }
+
+      vq->used_idx += 1;
+      vq->inflight--;
+    }
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  sleep(b, &disk[id].vdisk_lock);
+    // ask for the next interrupt, then look again - the device may have
+    // passed the new used_event before it saw it.
+    set_used_event(id, vq);
+    __sync_synchronize();
+  } while(disk[id].eventidx && vq->used_idx != vq->used->idx);
 
-  disk[id].info[idx[0]].b = 0;
-  free_chain(id, idx[0]);
+  if(freed && vq->descwait){
+    vq->descwait = 0;
+    wakeup(&vq->free[0]);
+  }
+}
 
-  release(&disk[id].vdisk_lock);
+// polling on for every request of disk id, or off, on < 0 only asks. returns the old setting.
+int
+virtio_disk_poll(int id, int on)
+{
+  if(on < 0)
+    return disk[id].poll;
+  return __sync_lock_test_and_set(&disk[id].poll, on);
+}
+
+// wait for virtio_disk_intr() to say request has finished.
+// on a polled disk (poll_raid) the waiter first spins on the used ring for
+// POLL_TIME and takes its completion itself - no interrupt, wakeup and reschedule on the way.
+void
+virtio_disk_wait(int id, struct ioreq *r)
+{
+  if(r->queue < 0)
+    panic("virtio_disk_wait");
+  struct vqueue *vq = &disk[id].vq[r->queue];
+
+  if(disk[id].poll){
+    uint64 end = r_time() + POLL_TIME;
+    while(!*(volatile int *)&r->done && r_time() < end){
+      if(*(volatile uint16 *)&vq->used->idx != *(volatile uint16 *)&vq->used_idx){
+        acquire(&vq->lock);
+        virtio_disk_harvest(id, vq);
+        release(&vq->lock);
+      }
+    }
+  }
+
+  // descriptors are already free - done needs no lock
+  if(*(volatile int *)&r->done){
+    __sync_synchronize();
+    return;
+  }
+
+  acquire(&vq->lock);
+
+  while(!r->done){
+    r->waiting = 1;
+    sleep(r, &vq->lock);
+  }
+
+  release(&vq->lock);
+}
+
+// block request of the buffer cache - goes through scheduler of the disk like RAID requests.
+void
+virtio_disk_rw(int id, struct buf *b, int write)
+{
+  b->disk = 1;
+  iosched_rw(id, b->blockno, 1, b->data, write);
+  b->disk = 0;
+}
+
+// requests of virtio_disk_rwv still in flight - its waiter sleeps once for all of them
+struct rwvcount {
+  struct spinlock lock;
+  int left;
+};
+
+// completion callback of virtio_disk_rwv, wakes the waiter with the last request,
+// or when a batch of the disk is to be given back - only the waiter starts what is queued behind it
+static void
+rwvdone(struct ioreq *r)
+{
+  struct rwvcount *c = r->arg;
+
+  acquire(&c->lock);
+  c->left--;
+  if(c->left == 0 || (r->batch && r->desc >= 0))
+    wakeup(c);
+  release(&c->lock);
+}
+
+// n block requests of the buffer cache at once - the scheduler merges
+// consecutive blocks into one request, and the rest are in flight together.
+void
+virtio_disk_rwv(int id, struct buf **b, int n, int write)
+{
+  struct rwvcount c;
+
+  // too many for the kernel stack
+  struct ioreq *r = kalloc();
+  int per = PGSIZE / sizeof(struct ioreq);
+  if(r == 0)
+    panic("virtio_disk_rwv");
+  initlock(&c.lock, "rwv");
+
+  for(int i = 0; i < n; i += per){
+    int m = n - i < per ? n - i : per;
+    c.left = m;
+    for(int k = 0; k < m; k++){
+      r[k].write = write;
+      r[k].discard = 0;
+      r[k].callback = rwvdone;
+      r[k].arg = &c;
+      r[k].blockno = b[i+k]->blockno;
+      r[k].n = 1;
+      r[k].data = b[i+k]->data;
+      b[i+k]->disk = 1;
+    }
+    iosched_submit(id, r, m);
+    for(int waited = 0; waited < m; ){
+      // one sleep for all requests done meanwhile - a polled disk spins in iosched_wait instead
+      if(!disk[id].poll){
+        acquire(&c.lock);
+        while(m - c.left == waited)
+          sleep(&c, &c.lock);
+        release(&c.lock);
+      }
+      // done requests give their batches back, which starts the requests queued behind them.
+      // polled, every started one is waited for - one still queued may need the batch of a later one
+      for(int k = 0; k < m; k++){
+        if(b[i+k]->disk && (*(volatile int *)&r[k].done || (disk[id].poll && *(volatile int *)&r[k].queue >= 0))){
+          iosched_wait(id, &r[k]);
+          b[i+k]->disk = 0;
+          waited++;
+        }
+      }
+    }
+  }
+
+  kfree(r);
 }
 
 void write_block(int diskn, int blockno, uchar* data) {
@@ -321,54 +668,177 @@ void write_block(int diskn, int blockno, uchar* data) {
     //}
     //printf("MAX DIRTY U drajvery: %d\n",raidmeta.maxdirty);
 
-    struct buf *b = transfer_buffer[diskn];
-    b->blockno = blockno;
-
-    memmove(b->data, data, BSIZE);
+    if (iosched_direct(data))
+    {
+        iosched_rw(diskn, blockno, 1, data, 1);
+    }
+    else
+    {
+        // data on kernel stack - device gets it through transfer buffer
+        struct buf *b = transfer_buffer[diskn];
+        acquiresleep(&b->lock);
+        memmove(b->data, data, BSIZE);
+        iosched_rw(diskn, blockno, 1, b->data, 1);
+        releasesleep(&b->lock);
+    }
 
-    virtio_disk_rw(diskn, b, 1);
+    csumwrite(diskn, blockno, data);
 }
 
 void read_block(int diskn, int blockno, uchar* data) {
-    struct buf *b = transfer_buffer[diskn];
-    b->blockno = blockno;
+    if (iosched_direct(data))
+    {
+        iosched_rw(diskn, blockno, 1, data, 0);
+        return;
+    }
 
-    virtio_disk_rw(diskn, b, 0);
+    struct buf *b = transfer_buffer[diskn];
+    acquiresleep(&b->lock);
+    iosched_rw(diskn, blockno, 1, b->data, 0);
     memmove(data, b->data, BSIZE);
+    releasesleep(&b->lock);
+}
+
+// n consecutive blocks - they are queued together, so the scheduler merges them
+// data must be mapped one to one (kalloc)
+void write_blocks(int diskn, int blockno, int n, uchar* data) {
+    if (!iosched_direct(data) || !iosched_direct(data + (n - 1) * BSIZE))
+        panic("write_blocks");
+    iosched_rw(diskn, blockno, n, data, 1);
+
+    for (int i = 0; i < n; i++)
+        csumwrite(diskn, blockno + i, data + i * BSIZE);
+}
+
+void read_blocks(int diskn, int blockno, int n, uchar* data) {
+    if (!iosched_direct(data) || !iosched_direct(data + (n - 1) * BSIZE))
+        panic("read_blocks");
+    iosched_rw(diskn, blockno, n, data, 0);
+}
+
+// n single blocks, block k is blockno[k] of disk diskn[k] - all are submitted before any is waited for,
+// so blocks on different disks move at the same time. data must be mapped one to one (kalloc)
+#define GATHER_BATCH 16
+
+static void rw_blocks(int n, int* diskn, int* blockno, uchar** data, int write) {
+    struct ioreq r[GATHER_BATCH];
+
+    for (int k = 0; k < n; k += GATHER_BATCH)
+    {
+        int m = n - k < GATHER_BATCH ? n - k : GATHER_BATCH;
+        for (int i = 0; i < m; i++)
+        {
+            if (!iosched_direct(data[k + i]))
+                panic("rw_blocks");
+            r[i].blockno = blockno[k + i];
+            r[i].n = 1;
+            r[i].data = data[k + i];
+            r[i].write = write;
+            r[i].discard = 0;
+            r[i].callback = 0;
+            iosched_submit(diskn[k + i], &r[i], 1);
+        }
+
+        for (int i = 0; i < m; i++)
+            iosched_wait(diskn[k + i], &r[i]);
+    }
+}
+
+void gather_blocks(int n, int* diskn, int* blockno, uchar** data) {
+    rw_blocks(n, diskn, blockno, data, 0);
+}
+
+// same for writes - consecutive blocks of a disk are merged by its scheduler
+void scatter_blocks(int n, int* diskn, int* blockno, uchar** data) {
+    rw_blocks(n, diskn, blockno, data, 1);
+
+    for (int k = 0; k < n; k++)
+        csumwrite(diskn[k], blockno[k], data[k]);
+}
+
+// n blocks from blockno hold nothing any more - the device may unmap them, and return
+// anything when they are read. does nothing if the device cannot discard.
+void discard_blocks(int diskn, int blockno, int n) {
+    if (!disk[diskn].discard)
+        return;
+
+    while (n > 0)
+    {
+        int m = n < disk[diskn].maxdiscard ? n : disk[diskn].maxdiscard;
+        iosched_discard(diskn, blockno, m);
+        blockno += m;
+        n -= m;
+    }
+}
+
+#define COPY_PAGES (IOSCHED_MERGE * BSIZE / PGSIZE)
+
+// copy n blocks from disk to disk - up to IOSCHED_MERGE blocks are read into separate pages
+// with one request (descriptor per page), and written with another
+void copy_blocks(int fromdiskn, int todiskn, int blockno, int n) {
+    struct ioreq r[COPY_PAGES];
+    uchar* page[COPY_PAGES];
+
+    int pages = 0;
+    while (pages < COPY_PAGES && pages * (PGSIZE / BSIZE) < n)
+    {
+        if ((page[pages] = kalloc()) == 0)
+            break;
+        pages++;
+    }
+    if (pages == 0)
+        panic("copy_blocks");
+
+    while (n > 0)
+    {
+        int m = 0;
+        for (; m < pages && n > 0; m++)
+        {
+            r[m].blockno = blockno;
+            r[m].n = n < PGSIZE / BSIZE ? n : PGSIZE / BSIZE;
+            r[m].data = page[m];
+            r[m].write = 0;
+            r[m].discard = 0;
+            r[m].callback = 0;
+            blockno += r[m].n;
+            n -= r[m].n;
+        }
+
+        iosched_submit(fromdiskn, r, m);
+        for (int i = 0; i < m; i++)
+            iosched_wait(fromdiskn, &r[i]);
+
+        for (int i = 0; i < m; i++)
+            r[i].write = 1;
+        iosched_submit(todiskn, r, m);
+        for (int i = 0; i < m; i++)
+            iosched_wait(todiskn, &r[i]);
+    }
+
+    for (int i = 0; i < pages; i++)
+        kfree(page[i]);
 }
 
 void
 virtio_disk_intr(int id)
 {
-  acquire(&disk[id].vdisk_lock);
-
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
   // this may race with the device writing new entries to
-  // the "used" ring, in which case we may process the new
+  // the "used" rings, in which case we may process the new
   // completion entries in this interrupt, and have nothing to do
   // in the next interrupt, which is harmless.
   *R(id, VIRTIO_MMIO_INTERRUPT_ACK) = *R(id, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk[id].used_idx != disk[id].used->idx){
-    __sync_synchronize();
-    int idx = disk[id].used->ring[disk[id].used_idx % NUM].id;
-
-    if(disk[id].info[idx].status != 0)
-      panic_concat(2, disk[id].name, ": virtio_disk_intr status");
-
-    struct buf *b = disk[id].info[idx].b;
-    b->disk = 0;   // disk is done with buf
-
-    wakeup(b);
-
-    disk[id].used_idx += 1;
+  // the device increments used->idx of a queue when it
+  // adds an entry to its used ring. one interrupt for
+  // all queues - each is harvested under its own lock.
+  for(int q = 0; q < disk[id].nqueue; q++){
+    struct vqueue *vq = &disk[id].vq[q];
+    acquire(&vq->lock);
+    virtio_disk_harvest(id, vq);
+    release(&vq->lock);
   }
-
-  release(&disk[id].vdisk_lock);
 }
@@ -0,0 +1,210 @@
+// raidhost - what kernel.c needs from the host: pthreads, the clock, and the disk files.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "raidhost/raidhost.h"
+
+#define PGSIZE 4096
+#define TIMEBASE 10000000L                  // ticks of r_time per second, as on qemu virt
+
+// sleep/wakeup - channels hash to buckets, a wakeup wakes every sleeper of its bucket,
+// and sleepers check their condition again, as in the kernel
+#define BUCKETS 64
+
+static struct bucket
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64 gen;                             // wakeups so far
+} buckets[BUCKETS];
+
+static pthread_mutex_t cpulock[NCPU];
+static int disk[DISKS + SPARES + 1];        // file of each kernel disk, 0 is the file system
+
+static struct bucket*
+bucketof(void* chan)
+{
+    return &buckets[((uint64)chan >> 3) % BUCKETS];
+}
+
+uint64
+host_sleepbegin(void* chan)
+{
+    struct bucket* b = bucketof(chan);
+    pthread_mutex_lock(&b->lock);
+    return b->gen;
+}
+
+void
+host_sleepwait(void* chan, uint64 gen)
+{
+    struct bucket* b = bucketof(chan);
+    while (b->gen == gen)
+        pthread_cond_wait(&b->cond, &b->lock);
+    pthread_mutex_unlock(&b->lock);
+}
+
+void
+host_wakeup(void* chan)
+{
+    struct bucket* b = bucketof(chan);
+    pthread_mutex_lock(&b->lock);
+    b->gen++;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+}
+
+void
+host_cpulock(int cpu)
+{
+    pthread_mutex_lock(&cpulock[cpu]);
+}
+
+void
+host_cpuunlock(int cpu)
+{
+    pthread_mutex_unlock(&cpulock[cpu]);
+}
+
+static void*
+threadstart(void* fn)
+{
+    ((void (*)(void))fn)();
+    return 0;
+}
+
+int
+host_thread(void (*fn)(void))
+{
+    pthread_t t;
+    if (pthread_create(&t, 0, threadstart, fn) != 0)
+        return -1;
+    pthread_detach(t);
+    return 0;
+}
+
+void
+host_yield(void)
+{
+    sched_yield();
+}
+
+void
+host_pause(int usec)
+{
+    usleep(usec);
+}
+
+uint64
+host_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * TIMEBASE + (uint64)ts.tv_nsec / (1000000000 / TIMEBASE);
+}
+
+void*
+host_pagealloc(void)
+{
+    void* page = aligned_alloc(PGSIZE, PGSIZE);
+    if (page)
+        memset(page, 5, PGSIZE);            // fill with junk, like kalloc
+    return page;
+}
+
+void
+host_pagefree(void* page)
+{
+    free(page);
+}
+
+void
+host_vprintf(char* fmt, va_list ap)
+{
+    vprintf(fmt, ap);
+}
+
+void
+host_abort(void)
+{
+    fflush(stdout);
+    abort();
+}
+
+// open disk_N.img of RAID disks and hot spares in dir, creating them as qemu-img would
+int
+host_opendisks(char* dir)
+{
+    for (int i = 0; i < DISKS + SPARES; i++)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/disk_%d.img", dir, i);
+
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0 || (lseek(fd, 0, SEEK_END) < DISK_SIZE_BYTES && ftruncate(fd, DISK_SIZE_BYTES) < 0))
+        {
+            perror(path);
+            return -1;
+        }
+        disk[i + 1] = fd;
+    }
+
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        pthread_mutex_init(&buckets[i].lock, 0);
+        pthread_cond_init(&buckets[i].cond, 0);
+    }
+    for (int i = 0; i < NCPU; i++)
+        pthread_mutex_init(&cpulock[i], 0);
+
+    return 0;
+}
+
+void
+host_rw(int diskn, uint64 blockno, uchar* data, int write)
+{
+    if (diskn < 1 || diskn > DISKS + SPARES || (blockno + 1) * BSIZE > DISK_SIZE_BYTES)
+    {
+        fprintf(stderr, "raidhost: bad block %ld of disk %d\n", (long)blockno, diskn);
+        host_abort();
+    }
+
+    off_t off = (off_t)blockno * BSIZE;
+    ssize_t n = write ? pwrite(disk[diskn], data, BSIZE, off) : pread(disk[diskn], data, BSIZE, off);
+    if (n != BSIZE)
+    {
+        perror("raidhost: disk");
+        host_abort();
+    }
+}
+
+// punch a hole, as qemu does with discard=unmap - the blocks read as zeros afterwards
+void
+host_discard(int diskn, uint64 blockno, int n)
+{
+    if (diskn < 1 || diskn > DISKS + SPARES || (blockno + n) * BSIZE > DISK_SIZE_BYTES)
+    {
+        fprintf(stderr, "raidhost: bad discard of %d blocks from %ld of disk %d\n", n, (long)blockno, diskn);
+        host_abort();
+    }
+
+    // file systems without holes keep the data, which is just as good
+    if (fallocate(disk[diskn], FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)blockno * BSIZE, (off_t)n * BSIZE) < 0 &&
+        errno != EOPNOTSUPP)
+    {
+        perror("raidhost: discard");
+        host_abort();
+    }
+}
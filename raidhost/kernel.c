@@ -0,0 +1,265 @@
+// raidhost - the part of the kernel the RAID engines call, on top of host.c.
+// compiled like the engines, with kernel headers only.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/proc.h"
+#include "kernel/fs.h"
+#include "kernel/defs.h"
+#include "kernel/raidstat.h"
+#include "raidhost/raidhost.h"
+
+uint ticks;
+struct spinlock tickslock;
+
+// every host thread is a process and a hart of its own - harts are shared when there are more than NCPU threads
+static __thread struct proc self;
+static __thread int noff;
+static int nextpid = 1;
+
+struct proc*
+myproc(void)
+{
+    if (self.pid == 0)
+    {
+        self.pid = __sync_fetch_and_add(&nextpid, 1);
+        self.state = RUNNING;
+    }
+    return &self;
+}
+
+int
+cpuid(void)
+{
+    return myproc()->pid % NCPU;
+}
+
+// threads sharing a hart take turns on its per-hart data
+void
+push_off(void)
+{
+    if (noff++ == 0)
+        host_cpulock(cpuid());
+}
+
+void
+pop_off(void)
+{
+    if (noff < 1)
+        panic("pop_off");
+    if (--noff == 0)
+        host_cpuunlock(cpuid());
+}
+
+void
+initlock(struct spinlock* lk, char* name)
+{
+    lk->name = name;
+    lk->locked = 0;
+    lk->cpu = 0;
+}
+
+// threads can be preempted while holding a spinlock, so spinning gives way after a while
+void
+acquire(struct spinlock* lk)
+{
+    for (int spins = 0; __sync_lock_test_and_set(&lk->locked, 1) != 0; spins++)
+        if (spins > 100)
+            host_yield();
+    __sync_synchronize();
+}
+
+void
+release(struct spinlock* lk)
+{
+    __sync_synchronize();
+    __sync_lock_release(&lk->locked);
+}
+
+// host_sleepbegin holds the wait channel until the sleeper waits,
+// so a wakeup after lk is released is not lost
+void
+sleep(void* chan, struct spinlock* lk)
+{
+    uint64 gen = host_sleepbegin(chan);
+    release(lk);
+    host_sleepwait(chan, gen);
+    acquire(lk);
+}
+
+void
+wakeup(void* chan)
+{
+    host_wakeup(chan);
+}
+
+void
+yield(void)
+{
+    host_yield();
+}
+
+int
+kthread(char* name, void (*fn)(void))
+{
+    return host_thread(fn);
+}
+
+void*
+kalloc(void)
+{
+    return host_pagealloc();
+}
+
+void
+kfree(void* pa)
+{
+    // fill with junk to catch dangling refs, like the kernel
+    memset(pa, 1, PGSIZE);
+    host_pagefree(pa);
+}
+
+void
+printf(char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    host_vprintf(fmt, ap);
+    va_end(ap);
+}
+
+void
+panic(char* s)
+{
+    printf("panic: %s\n", s);
+    host_abort();
+}
+
+void
+exit(int status)
+{
+    panic("exit");
+}
+
+void*
+memset(void* dst, int c, uint n)
+{
+    return __builtin_memset(dst, c, n);
+}
+
+void*
+memmove(void* dst, const void* src, uint n)
+{
+    return __builtin_memmove(dst, src, n);
+}
+
+uint64
+r_time(void)
+{
+    return host_time();
+}
+
+// disks - no scheduler, every block goes straight to its file
+
+void
+read_block(int diskn, int blockno, uchar* data)
+{
+    uint64 start = r_time();
+    raidstat_diskstart(diskn);
+    host_rw(diskn, blockno, data, 0);
+    raidstat_diskdone(diskn, 0, 1, start);
+}
+
+void
+write_block(int diskn, int blockno, uchar* data)
+{
+    uint64 start = r_time();
+    raidstat_diskstart(diskn);
+    host_rw(diskn, blockno, data, 1);
+    raidstat_diskdone(diskn, 1, 1, start);
+    csumwrite(diskn, blockno, data);
+}
+
+void
+copy_blocks(int fromdiskn, int todiskn, int blockno, int n)
+{
+    uchar* page = kalloc();
+    for (int i = 0; i < n; i++)
+    {
+        read_block(fromdiskn, blockno + i, page);
+        write_block(todiskn, blockno + i, page);
+    }
+    kfree(page);
+}
+
+void
+gather_blocks(int n, int* diskn, int* blockno, uchar** data)
+{
+    for (int k = 0; k < n; k++)
+        read_block(diskn[k], blockno[k], data[k]);
+}
+
+void
+scatter_blocks(int n, int* diskn, int* blockno, uchar** data)
+{
+    for (int k = 0; k < n; k++)
+        write_block(diskn[k], blockno[k], data[k]);
+}
+
+void
+discard_blocks(int diskn, int blockno, int n)
+{
+    uint64 start = r_time();
+    raidstat_diskstart(diskn);
+    host_discard(diskn, blockno, n);
+    raidstat_diskdone(diskn, 1, 0, start);
+}
+
+// the trace rings need harts and user memory - events are dropped on the host
+
+void
+trace(int event, uint64 arg)
+{
+}
+
+void
+tracebegin(int write)
+{
+}
+
+void
+traceend(int failed)
+{
+}
+
+int
+tracelock(char* name)
+{
+    return 0;
+}
+
+// clock interrupt - raidd waits on ticks while the array is busy
+static void
+ticker(void)
+{
+    for (;;)
+    {
+        host_pause(10000);          // 10 ms, like the timer of qemu
+        acquire(&tickslock);
+        ticks++;
+        wakeup(&ticks);
+        release(&tickslock);
+    }
+}
+
+void
+raidhost_init(void)
+{
+    initlock(&tickslock, "time");
+    if (host_thread(ticker) < 0)
+        panic("raidhost_init");
+}
@@ -0,0 +1,638 @@
+// raidhost - throughput and fault injection driver for the RAID engines, on the host.
+//
+// raidhost [-t type|all] [-p seq|rand|zipf] [-o read|write|mix] [-r readpercent]
+//          [-n ops] [-P threads] [-f] [-s rate] [-c] [-b blocks] [-x percent] [-d dir]
+//
+// threads do ops requests each on the chosen RAID levels, on dir/disk_N.img (default raidhost/).
+// every thread owns the blocks b with b % threads == its number, so it knows what they hold:
+// each read of a block written during the run is checked.
+// -f fails and repairs disks while the threads run, as many at a time as the level survives, and
+// now and then the hot spare being rebuilt, then lets RAID5D finish its distributed spare, so the repair copies it
+// back, repairs everything, waits for rebuild, and checks every written block again - and that every disk
+// a hot spare took the place of stands by as a spare after its slot is repaired.
+// -s scrubs rate rows per tick while the threads run, then waits for the pass to end and checks
+// every written block - scrub of an array nothing corrupted must repair nothing, or the run fails.
+// -c turns on per-block checksums. -b then flips a byte in that many blocks right on the disk files,
+// at most one per stripe, and checks every written block - each must come back from redundancy.
+// with -s a scrub pass goes over the rotted blocks first, and must rebuild them.
+// -x discards the whole array before the run, then percent of the requests discard their block;
+// reads of discarded blocks must return zeros, and rebuild and scrub skip clusters with nothing left.
+// every run prints one line of key=value pairs, like raidbench; exits with 1 if data was lost.
+//
+// raidhost -t type -m fs.img [-d dir]
+//
+// sets up a new array of type on dir/disk_N.img and writes fs.img made by mkfs onto it, for a kernel
+// built with ROOTRAID: make qemu ROOTRAID=type does so in the top directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/raid.h"
+#include "kernel/raidstat.h"
+#include "raidhost/raidhost.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+extern struct RAIDMeta raidmeta;
+
+static char* typenames[] = {"RAID0", "RAID1", "RAID0_1", "RAID4", "RAID5", "RAID6", "RAID5D"};
+static char* patternnames[] = {"seq", "rand", "zipf"};
+static char* opnames[] = {"read", "write", "mix"};
+
+enum PATTERN {SEQ, RAND, ZIPF};
+enum OP {READ, WRITE, MIX};
+
+// zipf - share of requests that go to the hottest fifth of the blocks, at every level
+#define HOT 80
+
+// latency histogram - 16 linear buckets per power of two, error below 1/16
+#define SUBBUCKETS 16
+#define BUCKETS (SUBBUCKETS * 40)
+
+// version of a block discarded during the run - it reads as zeros
+#define DISCARDED 255
+
+// failed disk stays out for FAULT_MIN..FAULT_MAX microseconds
+#define FAULT_MIN 2000
+#define FAULT_MAX 20000
+
+struct worker
+{
+    pthread_t thread;
+    int n;                      // number of the thread, owns blocks with b % threads == n
+    uint64 seed;
+    uint8* version;             // of owned blocks, 0 if not written during the run, or DISCARDED
+    uint64 start, end;
+    uint ops, errors, corrupt;
+    uint hist[BUCKETS];
+};
+
+static int pattern = RAND, op = MIX, readpct = 50, ops = 10000, threads = 4, scrub, checksums, bitrot, discardpct, faults;
+static uint blocks;
+static struct worker* workers;
+static volatile int running;
+
+// time in nanoseconds
+static uint64
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+bucket(uint64 ns)
+{
+    if (ns < SUBBUCKETS)
+        return ns;
+
+    int e = 0;
+    while ((ns >> e) >= 2 * SUBBUCKETS)
+        e++;
+    int b = (e + 1) * SUBBUCKETS + (ns >> e) - SUBBUCKETS;
+    return b < BUCKETS ? b : BUCKETS - 1;
+}
+
+// smallest latency of bucket
+static uint64
+bucketns(int b)
+{
+    if (b < SUBBUCKETS)
+        return b;
+
+    int e = b / SUBBUCKETS - 1;
+    return (uint64)(b % SUBBUCKETS + SUBBUCKETS) << e;
+}
+
+static uint64
+percentile(uint* hist, uint64 n, int pct)
+{
+    uint64 want = (n * pct + 99) / 100;
+    uint64 seen = 0;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        seen += hist[b];
+        if (seen >= want && seen > 0)
+            return bucketns(b);
+    }
+    return 0;
+}
+
+static uint64
+rnd(uint64* seed)
+{
+    // xorshift64
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+// self-similar hot spot - HOT percent of requests go to the first fifth, and so on inside it
+static uint
+zipf(uint64* seed, uint n)
+{
+    while (n > 1 && rnd(seed) % 100 < HOT)
+        n = (n + 4) / 5;
+    return rnd(seed) % n;
+}
+
+// block of the pattern, moved to one the worker owns
+static uint
+pickblock(struct worker* w, int i)
+{
+    uint b;
+    switch (pattern)
+    {
+        case SEQ:
+            b = ((uint64)w->n * blocks / threads + (uint64)i * threads) % blocks;
+            break;
+        case ZIPF:
+            b = (uint64)zipf(&w->seed, blocks) * 7919 % blocks;         // scatter hot blocks over the disks
+            break;
+        default:
+            b = rnd(&w->seed) % blocks;
+    }
+
+    b = b - b % threads + w->n;
+    return b < blocks ? b : b - threads;
+}
+
+// content of block b after its version-th write in the run
+static void
+fill(uchar* data, uint b, uint8 version)
+{
+    uint64* word = (uint64*)data;
+    for (int i = 0; i < BSIZE / sizeof(uint64); i++)
+        word[i] = ((uint64)b << 32) ^ ((uint64)version << 24) ^ i;
+}
+
+static int
+check(uchar* data, uint b, uint8 version)
+{
+    uchar want[BSIZE];
+    if (version == DISCARDED)
+        memset(want, 0, BSIZE);
+    else
+        fill(want, b, version);
+    return memcmp(data, want, BSIZE) == 0;
+}
+
+static void*
+work(void* arg)
+{
+    struct worker* w = arg;
+    uchar data[BSIZE];
+
+    w->start = now();
+    for (int i = 0; i < ops; i++)
+    {
+        uint b = pickblock(w, i);
+        uint8* version = &w->version[b / threads];
+        int discard = discardpct && rnd(&w->seed) % 100 < discardpct;
+        int write = !discard && (op == WRITE || (op == MIX && rnd(&w->seed) % 100 >= readpct));
+
+        // versions wrap, 0 stays for never written
+        uint8 next = *version >= DISCARDED - 1 ? 1 : *version + 1;
+        if (write)
+            fill(data, b, next);
+
+        uint64 t = now();
+        uint64 ret = discard ? discardraid(b, 1) : write ? writeraid(b, data) : readraid(b, data);
+        w->hist[bucket(now() - t)]++;
+
+        w->ops++;
+        if (discard && ret != -1)
+            *version = DISCARDED;
+        else if (ret == -1)
+        {
+            w->errors++;
+            if (write)
+                *version = 0;           // content unknown - not checked any more
+        }
+        else if (write)
+            *version = next;
+        else if (*version && !check(data, b, *version))
+            w->corrupt++;
+    }
+    w->end = now();
+
+    return 0;
+}
+
+// disks a level survives losing
+static int
+tolerance(int type)
+{
+    switch (type)
+    {
+        case RAID0:
+            return 0;
+        case RAID6:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+static int
+invaliddisks(void)
+{
+    int n = 0;
+    for (int i = 0; i < DISKS; i++)
+        if (!raidmeta.diskinfo[i].valid)
+            n++;
+    return n;
+}
+
+// fail a disk while the array can lose one more, otherwise repair one - until the workers are done
+static void*
+inject(void* arg)
+{
+    int type = *(int*)arg;
+    uint64 seed = 0x2545f4914f6cdd1dULL;
+
+    while (running)
+    {
+        usleep(FAULT_MIN + rnd(&seed) % (FAULT_MAX - FAULT_MIN));
+
+        // now and then the hot spare being rebuilt fails too - another one starts over in its place
+        int rebuilding = raidmeta.rebuilding;
+        if (rebuilding >= 0 && rnd(&seed) % 4 == 0)
+        {
+            if (raidfail(rebuilding + 1) == 0)
+                faults++;
+            continue;
+        }
+
+        int diskn = 1 + rnd(&seed) % DISKS;
+        if (invaliddisks() < tolerance(type))
+        {
+            if (raidmeta.diskinfo[diskn - 1].valid && raidfail(diskn) == 0)
+                faults++;
+        }
+        else
+        {
+            for (int i = 0; i < DISKS; i++)
+                if (!raidmeta.diskinfo[i].valid)
+                    raidrepair(i + 1);
+        }
+    }
+
+    return 0;
+}
+
+// repair every disk and wait for raidd to finish rebuilding hot spares
+// a RAID5D disk is repaired only after its distributed spare is complete
+static void
+repairall(void)
+{
+    while (sparependingraid5d())
+        usleep(1000);
+
+    while (invaliddisks())
+    {
+        for (int i = 0; i < DISKS; i++)
+            if (!raidmeta.diskinfo[i].valid)
+                raidrepair(i + 1);
+        usleep(1000);
+    }
+
+    // disks hot spares took the place of are replaced too - slots rebuilt on a spare are valid already
+    for (int i = 0; i < DISKS; i++)
+        raidrepair(i + 1);
+}
+
+// hot spares that can be taken
+static int
+freespares(void)
+{
+    int n = 0;
+    for (int s = 0; s < SPARES; s++)
+        if (raidmeta.spare[s] && !raidmeta.sparefailed[s])
+            n++;
+    return n;
+}
+
+// count of event so far
+static uint64
+events(int event)
+{
+    struct RAIDStat stat;
+    raidstat_sum(&stat);
+    return stat.events[event];
+}
+
+// flip a byte in n blocks of the disks behind the back of the engines, at most one per stripe
+// (per tile for RAID5D, where a group spans the rows of a tile) and only on disks with a copy elsewhere
+static void
+rot(int type, int n)
+{
+    uint rows = diskblockn();
+    uint unit = type == RAID5D ? DCL_GROUP : 1;
+    int disks = type == RAID1 || type == RAID0_1 ? DISKS / 2 * 2 : DISKS;
+    uint8* hit = calloc(rows / unit + 1, 1);
+    uint64 seed = 0x5851f42d4c957f2dULL;
+    uchar data[BSIZE];
+
+    for (int i = 0; i < n && i < rows / unit; i++)
+    {
+        uint row;
+        do
+            row = rnd(&seed) % rows;
+        while (hit[row / unit]);
+        hit[row / unit] = 1;
+
+        int diskn = raidmeta.diskinfo[rnd(&seed) % disks].diskn;
+        host_rw(diskn, row, data, 0);
+        data[rnd(&seed) % BSIZE] ^= 0x5a;
+        host_rw(diskn, row, data, 1);
+    }
+
+    free(hit);
+}
+
+// read back every block written during the run
+static uint
+verify(void)
+{
+    uint corrupt = 0;
+    uchar data[BSIZE];
+
+    for (int t = 0; t < threads; t++)
+    {
+        for (uint b = t; b < blocks; b += threads)
+        {
+            uint8 version = workers[t].version[b / threads];
+            if (version && (readraid(b, data) == -1 || !check(data, b, version)))
+                corrupt++;
+        }
+    }
+    return corrupt;
+}
+
+static int
+run(int type, int inject_faults)
+{
+    printf("raidhost type=%s pattern=%s op=%s threads=%d ", typenames[type], patternnames[pattern], opnames[op], threads);
+
+    if (setraidtype(type, 0, DISKS) == -1)
+    {
+        printf("error=init\n");
+        return 0;
+    }
+    blocks = raidblockn();
+
+    workers = calloc(threads, sizeof(struct worker));
+    for (int t = 0; t < threads; t++)
+    {
+        workers[t].n = t;
+        workers[t].seed = 0x9e3779b97f4a7c15ULL * (t + 1);
+        workers[t].version = calloc(blocks / threads + 1, 1);
+    }
+
+    checksumraid(checksums);
+    if (discardpct)
+    {
+        // like a new file system - every block starts discarded
+        discardraid(0, blocks);
+        for (int t = 0; t < threads; t++)
+            memset(workers[t].version, DISCARDED, blocks / threads + 1);
+    }
+    uint64 repairs = events(STAT_SCRUBREPAIR);
+    uint64 mismatches = events(STAT_CSUMERROR);
+    if (scrub)
+        scrubraid(scrub);
+
+    running = 1;
+    faults = 0;
+    pthread_t injector;
+    if (inject_faults && tolerance(type) > 0)
+        pthread_create(&injector, 0, inject, &type);
+    else
+        inject_faults = 0;
+
+    for (int t = 0; t < threads; t++)
+        pthread_create(&workers[t].thread, 0, work, &workers[t]);
+    for (int t = 0; t < threads; t++)
+        pthread_join(workers[t].thread, 0);
+
+    running = 0;
+    if (inject_faults)
+    {
+        pthread_join(injector, 0);
+        repairall();
+    }
+
+    // scrub waits while disks are invalid or rebuilt, and RAID0 has nothing to scrub
+    if (scrub)
+        while (scrubraid(-1) > 0)
+            usleep(1000);
+
+    // scrub of an array nothing corrupted must repair nothing - every repair overwrote a good block
+    uint64 fixed = events(STAT_SCRUBREPAIR) - repairs;
+    uint lost = scrub ? fixed : 0;
+
+    // after every slot is repaired, the pool of hot spares is full again
+    int spares = freespares();
+    if (inject_faults)
+        lost += SPARES - spares;
+
+    int rotted = bitrot && tolerance(type) > 0;
+    if (rotted)
+    {
+        rot(type, bitrot);
+
+        // with -s another pass goes over the rot before any read - it must rebuild the rotted
+        // blocks from redundancy, not make redundancy match them
+        if (scrub)
+        {
+            scrubraid(scrub);
+            while (scrubraid(-1) > 0)
+                usleep(1000);
+        }
+    }
+
+    uint64 start = workers[0].start, end = 0, total = 0;
+    uint errors = 0, corrupt = 0;
+    static uint hist[BUCKETS];
+    memset(hist, 0, sizeof(hist));
+    for (int t = 0; t < threads; t++)
+    {
+        struct worker* w = &workers[t];
+        if (w->start < start)
+            start = w->start;
+        if (w->end > end)
+            end = w->end;
+        total += w->ops;
+        errors += w->errors;
+        corrupt += w->corrupt;
+        for (int b = 0; b < BUCKETS; b++)
+            hist[b] += w->hist[b];
+    }
+    if (inject_faults || scrub || rotted || discardpct)
+        corrupt += verify();
+
+    uint64 us = (end - start) / 1000;
+    if (us == 0)
+        us = 1;
+    printf("ops=%lu errors=%u faults=%d spares=%d scrubfixed=%lu csumerrors=%lu corrupt=%u usec=%lu iops=%lu kbps=%lu p50ns=%lu p99ns=%lu\n",
+           total, errors, faults, spares, events(STAT_SCRUBREPAIR) - repairs, events(STAT_CSUMERROR) - mismatches, corrupt, us,
+           total * 1000000 / us, total * BSIZE * 1000000 / 1024 / us,
+           percentile(hist, total, 50), percentile(hist, total, 99));
+
+    for (int t = 0; t < threads; t++)
+        free(workers[t].version);
+    free(workers);
+
+    return corrupt + lost;
+}
+
+// -m: set up a new array of type and lay the file system image made by mkfs onto it, from block 0,
+// so a kernel built with ROOTRAID boots from it - the rest of the array is discarded
+static int
+format(int type, char* image)
+{
+    FILE* f = fopen(image, "r");
+    if (!f)
+    {
+        perror(image);
+        return -1;
+    }
+
+    if (setraidtype(type, 0, DISKS) == -1)
+    {
+        fprintf(stderr, "raidhost: cannot set up %s\n", typenames[type]);
+        fclose(f);
+        return -1;
+    }
+
+    uchar data[BSIZE];
+    uint64 b = 0;
+    size_t n;
+    while ((n = fread(data, 1, BSIZE, f)) > 0)
+    {
+        memset(data + n, 0, BSIZE - n);
+        if (b >= raidblockn() || writeraid(b, data) == -1)
+        {
+            fprintf(stderr, "raidhost: %s does not fit on %s of %lu blocks\n", image, typenames[type], raidblockn());
+            fclose(f);
+            return -1;
+        }
+        b++;
+    }
+    fclose(f);
+
+    discardraid(b, raidblockn() - b);
+    printf("raidhost: %s on %s, %lu of %lu blocks\n", image, typenames[type], b, raidblockn());
+    return 0;
+}
+
+// index of name in names, -1 if none
+static int
+lookup(char* name, char** names, int n)
+{
+    for (int i = 0; i < n; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: raidhost [-t type|all] [-p seq|rand|zipf] [-o read|write|mix] [-r readpercent]\n"
+                    "                [-n ops] [-P threads] [-f] [-s rate] [-c] [-b blocks] [-x percent] [-d dir]\n"
+                    "       raidhost -t type -m fs.img [-d dir]\n");
+    exit(1);
+}
+
+int
+main(int argc, char* argv[])
+{
+    int type = -1, inject_faults = 0;
+    char* dir = "raidhost";
+    char* image = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:p:o:r:n:P:fs:cb:x:d:m:")) != -1)
+    {
+        switch (c)
+        {
+            case 't':
+                if (strcmp(optarg, "all") != 0 && (type = lookup(optarg, typenames, NELEM(typenames))) < 0)
+                    usage();
+                break;
+            case 'p':
+                if ((pattern = lookup(optarg, patternnames, NELEM(patternnames))) < 0)
+                    usage();
+                break;
+            case 'o':
+                if ((op = lookup(optarg, opnames, NELEM(opnames))) < 0)
+                    usage();
+                break;
+            case 'r':
+                readpct = atoi(optarg);
+                break;
+            case 'n':
+                ops = atoi(optarg);
+                break;
+            case 'P':
+                threads = atoi(optarg);
+                break;
+            case 'f':
+                inject_faults = 1;
+                break;
+            case 's':
+                scrub = atoi(optarg);
+                break;
+            case 'c':
+                checksums = 1;
+                break;
+            case 'b':
+                bitrot = atoi(optarg);
+                break;
+            case 'x':
+                discardpct = atoi(optarg);
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'm':
+                image = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (optind != argc || threads < 1 || ops < 1 || scrub < 0 || bitrot < 0 || readpct < 0 || readpct > 100 ||
+        discardpct < 0 || discardpct > 100 || (image && type < 0))
+        usage();
+
+    if (host_opendisks(dir) < 0)
+        return 1;
+
+    raidhost_init();
+    loadraid();
+    if (image)
+        return format(type, image) < 0 ? 1 : 0;
+    raiddinit();
+
+    int lost = 0;
+    for (int t = 0; t < NELEM(typenames); t++)
+        if (type < 0 || t == type)
+            lost += run(t, inject_faults);
+
+    return lost ? 1 : 0;
+}
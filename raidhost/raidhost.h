@@ -0,0 +1,49 @@
+// raidhost - the RAID engines of the kernel, built for the host.
+//
+// kernel/raid*.c and kernel/sleeplock.c are compiled unchanged with -DRAIDHOST.
+// kernel.c gives them what the rest of the kernel would (locks, sleep/wakeup, kalloc,
+// kthread, read_block/write_block), on top of host.c, which owns everything of libc:
+// pthreads, and pread/pwrite on disk_N.img files - disk n of the kernel is disk_(n-1).img,
+// the same files qemu gets.
+// kernel names that libc has too (printf, sleep, exit, memset, memmove) are renamed
+// in kernel objects by the Makefile, so the two sides never see each other's headers.
+
+#include <stdarg.h>
+
+// host.c
+void            host_vprintf(char* fmt, va_list ap);
+void            host_abort(void) __attribute__((noreturn));
+void*           host_pagealloc(void);
+void            host_pagefree(void* page);
+int             host_thread(void (*fn)(void));
+void            host_yield(void);
+void            host_pause(int usec);
+uint64          host_time(void);
+uint64          host_sleepbegin(void* chan);
+void            host_sleepwait(void* chan, uint64 gen);
+void            host_wakeup(void* chan);
+void            host_cpulock(int cpu);
+void            host_cpuunlock(int cpu);
+int             host_opendisks(char* dir);
+void            host_rw(int diskn, uint64 blockno, uchar* data, int write);
+void            host_discard(int diskn, uint64 blockno, int n);
+
+// kernel.c
+void            raidhost_init(void);
+
+// RAID engines, for the driver - declared here because it cannot include defs.h
+void            loadraid(void);
+void            raiddinit(void);
+uint64          setraidtype(int type, int layout, int members);
+uint64          raidblockn(void);
+uint64          readraid(int vblkn, uchar* data);
+uint64          writeraid(int vblkn, uchar* data);
+uint64          raidfail(int diskn);
+uint64          raidrepair(int diskn);
+int             scrubraid(int rate);
+int             checksumraid(int on);
+uint64          discardraid(int blkn, int count);
+uint64          diskblockn();
+int             sparependingraid5d(void);
+struct RAIDStat;
+void            raidstat_sum(struct RAIDStat* sum);
@@ -0,0 +1,234 @@
+// tracedec - per-phase latency breakdown of RAID requests traced by raidtrace.
+// runs on the host: tracedec < console.log
+// lines that do not start with "T " are skipped, so the whole console can be given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel/types.h"
+#include "kernel/trace.h"
+
+// phases of a request, in cycles of the time CSR
+enum PHASE {PH_LOCK, PH_GATE, PH_QUEUE, PH_DEVICE, PH_PARITY, PH_OTHER, PH_CLUSTER, PHASES};
+
+static char* phasename[PHASES] = {
+    "lock wait", "repair gate", "disk queue", "device", "parity", "other", "(cluster load)"
+};
+static char* lockname[] = {"other", "disk", "cluster", "transfer buffer"};
+
+struct request
+{
+    int write;
+    int failed;
+    uint64 start, done;
+    uint64 phase[PHASES];
+    uint64 lockwait, gatewait, cluster, parity;     // start of open phase, 0 if none
+    int lockclass;
+};
+
+// disk request between submit and complete
+struct diskreq
+{
+    uint32 req;
+    int disk;
+    uint64 block;
+    uint64 submit, issue;
+};
+
+static struct TraceEvent* ev;
+static int nev;
+static struct request* reqs;
+static uint32 nreqs;
+static struct diskreq open[1024];
+static int nopen;
+static uint64 lockbyclass[4];
+static uint64 dropped;
+
+static int
+bytime(const void* a, const void* b)
+{
+    const struct TraceEvent* x = a;
+    const struct TraceEvent* y = b;
+    return x->time < y->time ? -1 : x->time > y->time;
+}
+
+static struct diskreq*
+finddisk(struct TraceEvent* e)
+{
+    for (int i = 0; i < nopen; i++)
+        if (open[i].req == e->req && open[i].disk == e->disk && open[i].block == e->arg)
+            return &open[i];
+    return 0;
+}
+
+static void
+event(struct TraceEvent* e)
+{
+    if (e->event == TR_DROPPED)
+    {
+        dropped += e->arg;
+        return;
+    }
+    if (e->req == 0 || e->req > nreqs)
+        return;
+
+    struct request* r = &reqs[e->req];
+    struct diskreq* d;
+
+    switch (e->event)
+    {
+        case TR_START:
+            r->write = e->arg;
+            r->start = e->time;
+            break;
+        case TR_DONE:
+            r->failed = e->arg;
+            r->done = e->time;
+            break;
+        case TR_LOCKWAIT:
+            r->lockwait = e->time;
+            r->lockclass = e->arg < 4 ? e->arg : 0;
+            break;
+        case TR_LOCKED:
+            if (r->lockwait)
+            {
+                r->phase[PH_LOCK] += e->time - r->lockwait;
+                lockbyclass[r->lockclass] += e->time - r->lockwait;
+            }
+            r->lockwait = 0;
+            break;
+        case TR_GATEWAIT:
+            if (!r->gatewait)
+                r->gatewait = e->time;
+            break;
+        case TR_GATEPASS:
+            if (r->gatewait)
+                r->phase[PH_GATE] += e->time - r->gatewait;
+            r->gatewait = 0;
+            break;
+        case TR_CLUSTERLOAD:
+            r->cluster = e->time;
+            break;
+        case TR_CLUSTERDONE:
+            if (r->cluster)
+                r->phase[PH_CLUSTER] += e->time - r->cluster;
+            r->cluster = 0;
+            break;
+        case TR_PARITY:
+            r->parity = e->time;
+            break;
+        case TR_PARITYDONE:
+            if (r->parity)
+                r->phase[PH_PARITY] += e->time - r->parity;
+            r->parity = 0;
+            break;
+        case TR_SUBMIT:
+            if (nopen < sizeof(open) / sizeof(open[0]))
+                open[nopen++] = (struct diskreq){e->req, e->disk, e->arg, e->time, 0};
+            break;
+        case TR_ISSUE:
+            if ((d = finddisk(e)) != 0)
+                d->issue = e->time;
+            break;
+        case TR_COMPLETE:
+            if ((d = finddisk(e)) != 0)
+            {
+                uint64 issue = d->issue ? d->issue : d->submit;
+                r->phase[PH_QUEUE] += issue - d->submit;
+                r->phase[PH_DEVICE] += e->time - issue;
+                *d = open[--nopen];
+            }
+            break;
+    }
+}
+
+static void
+report(char* name, int write)
+{
+    uint64 sum[PHASES] = {0};
+    uint64 total = 0, max = 0;
+    int n = 0, failed = 0;
+
+    for (uint32 i = 1; i <= nreqs; i++)
+    {
+        struct request* r = &reqs[i];
+        if (!r->start || !r->done || r->write != write)
+            continue;
+
+        uint64 t = r->done - r->start;
+        uint64 known = 0;
+        for (int p = 0; p < PH_OTHER; p++)
+            known += r->phase[p];
+        r->phase[PH_OTHER] = t > known ? t - known : 0;
+
+        for (int p = 0; p < PHASES; p++)
+            sum[p] += r->phase[p];
+        total += t;
+        if (t > max)
+            max = t;
+        n++;
+        failed += r->failed;
+    }
+
+    if (n == 0)
+        return;
+
+    printf("%s: %d requests (%d failed), mean %lu cycles, max %lu\n", name, n, failed, total / n, max);
+    for (int p = 0; p < PHASES; p++)
+        printf("  %-16s %10lu  %5.1f%%\n", phasename[p], sum[p] / n, total ? 100.0 * sum[p] / total : 0.0);
+}
+
+int
+main(int argc, char* argv[])
+{
+    char line[256];
+    int cap = 1024;
+    ev = malloc(cap * sizeof(*ev));
+
+    while (fgets(line, sizeof(line), stdin))
+    {
+        uint64 time, arg;
+        unsigned int req, event, cpu, disk;
+        if (sscanf(line, "T %lu %u %u %u %u %lu", &time, &req, &event, &cpu, &disk, &arg) != 6)
+            continue;
+
+        if (nev == cap)
+        {
+            cap *= 2;
+            ev = realloc(ev, cap * sizeof(*ev));
+        }
+        ev[nev++] = (struct TraceEvent){time, req, event, cpu, disk, arg};
+        if (req > nreqs)
+            nreqs = req;
+    }
+
+    if (nev == 0)
+    {
+        fprintf(stderr, "tracedec: no events\n");
+        return 1;
+    }
+
+    // harts drain their rings separately
+    qsort(ev, nev, sizeof(*ev), bytime);
+
+    reqs = calloc(nreqs + 1, sizeof(*reqs));
+    for (int i = 0; i < nev; i++)
+        event(&ev[i]);
+
+    printf("%d events, %u requests", nev, nreqs);
+    if (dropped)
+        printf(", %lu events dropped - phases may be incomplete", dropped);
+    printf("\n\n");
+
+    report("read_raid", 0);
+    report("write_raid", 1);
+
+    printf("\nlock wait by lock:\n");
+    for (int c = 0; c < 4; c++)
+        if (lockbyclass[c])
+            printf("  %-16s %10lu\n", lockname[c], lockbyclass[c]);
+    printf("\ncycles of the time CSR, 10 per us on qemu virt. cluster load overlaps the other phases.\n");
+
+    return 0;
+}
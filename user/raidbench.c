@@ -0,0 +1,340 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+// raidbench - workload generator for the RAID syscalls.
+//
+// raidbench [-t type|all] [-s normal|degraded|rebuild|all] [-p seq|rand|zipf]
+//           [-o read|write|mix] [-r readpercent] [-n ops] [-P procs]
+//
+// every run prints one line of key=value pairs, so results can be compared across kernels:
+// raidbench type=RAID5 scenario=normal pattern=rand op=mix procs=4 ops=2000 errors=0 usec=... iops=... kbps=... p50=... p99=...
+// latencies are in microseconds.
+
+static char* typenames[] = {"RAID0", "RAID1", "RAID0_1", "RAID4", "RAID5", "RAID6", "RAID5D"};
+static char* scenarionames[] = {"normal", "degraded", "rebuild"};
+static char* patternnames[] = {"seq", "rand", "zipf"};
+static char* opnames[] = {"read", "write", "mix"};
+
+enum SCENARIO {NORMAL, DEGRADED, REBUILD};
+enum PATTERN {SEQ, RAND, ZIPF};
+enum OP {READ, WRITE, MIX};
+
+// disk failed in degraded and rebuild runs
+#define FAILDISK 1
+
+// zipf - share of requests that go to the hottest fifth of the blocks, at every level
+#define HOT 80
+
+// latency histogram - 16 linear buckets per power of two, error below 1/16
+#define SUBBUCKETS 16
+#define BUCKETS (SUBBUCKETS * 40)
+
+struct result
+{
+    uint64 start, end;          // first and last op of the process
+    uint ops, errors;
+    uint hist[BUCKETS];
+};
+
+static struct result total, part;
+
+// time in microseconds
+uint64
+now(void)
+{
+    return nanotime() / 1000;
+}
+
+int
+bucket(uint64 us)
+{
+    if (us < SUBBUCKETS)
+        return us;
+
+    int e = 0;
+    while ((us >> e) >= 2 * SUBBUCKETS)
+        e++;
+    int b = (e + 1) * SUBBUCKETS + (us >> e) - SUBBUCKETS;
+    return b < BUCKETS ? b : BUCKETS - 1;
+}
+
+// smallest latency of bucket
+uint64
+bucketus(int b)
+{
+    if (b < SUBBUCKETS)
+        return b;
+
+    int e = b / SUBBUCKETS - 1;
+    return (uint64)(b % SUBBUCKETS + SUBBUCKETS) << e;
+}
+
+uint64
+percentile(struct result* r, int pct)
+{
+    uint64 want = ((uint64)r->ops * pct + 99) / 100;
+    uint64 seen = 0;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        seen += r->hist[b];
+        if (seen >= want && seen > 0)
+            return bucketus(b);
+    }
+    return 0;
+}
+
+static uint64 seed;
+
+uint64
+rnd(void)
+{
+    // xorshift64
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+// self-similar hot spot - HOT percent of requests go to the first fifth, and so on inside it
+uint
+zipf(uint n)
+{
+    while (n > 1 && rnd() % 100 < HOT)
+        n = (n + 4) / 5;
+    return rnd() % n;
+}
+
+uint
+pickblock(int pattern, int proc, int i, uint blocks)
+{
+    switch (pattern)
+    {
+        case SEQ:
+            return ((uint64)proc * blocks / 16 + i) % blocks;       // processes start apart
+        case ZIPF:
+            return (uint64)zipf(blocks) * 7919 % blocks;            // scatter hot blocks over the disks
+        default:
+            return rnd() % blocks;
+    }
+}
+
+int
+readall(int fd, void* buf, int n)
+{
+    char* p = buf;
+    while (n > 0)
+    {
+        int m = read(fd, p, n);
+        if (m <= 0)
+            return -1;
+        p += m;
+        n -= m;
+    }
+    return 0;
+}
+
+void
+worker(int fd, int proc, int pattern, int op, int readpct, int ops, uint blocks, uint blocksize)
+{
+    uchar* data = malloc(blocksize);
+    memset(data, proc, blocksize);
+    memset(&part, 0, sizeof(part));
+    seed = 0x9e3779b97f4a7c15ULL * (getpid() + 1);
+
+    part.start = now();
+    for (int i = 0; i < ops; i++)
+    {
+        uint blkn = pickblock(pattern, proc, i, blocks);
+        int write = op == WRITE || (op == MIX && rnd() % 100 >= readpct);
+
+        uint64 t = now();
+        int ret = write ? write_raid(blkn, data) : read_raid(blkn, data);
+        part.hist[bucket(now() - t)]++;
+
+        part.ops++;
+        if (ret < 0)
+            part.errors++;
+    }
+    part.end = now();
+
+    write(fd, &part, sizeof(part));
+    free(data);
+}
+
+void
+run(int type, int scenario, int pattern, int op, int readpct, int ops, int procs)
+{
+    printf("raidbench type=%s scenario=%s pattern=%s op=%s procs=%d ",
+           typenames[type], scenarionames[scenario], patternnames[pattern], opnames[op], procs);
+
+    // RAID0 has no redundancy
+    if (scenario != NORMAL && type == RAID0)
+    {
+        printf("skipped=1\n");
+        return;
+    }
+
+    if (init_raid(type) < 0)
+    {
+        printf("error=init\n");
+        return;
+    }
+
+    uint blocks, blocksize, disks;
+    info_raid(&blocks, &blocksize, &disks);
+
+    if (scenario != NORMAL)
+        disk_fail_raid(FAILDISK);
+
+    // rebuild runs next to the workload
+    int rebuilder = -1;
+    if (scenario == REBUILD)
+    {
+        rebuilder = fork();
+        if (rebuilder == 0)
+        {
+            disk_repaired_raid(FAILDISK);
+            exit(0);
+        }
+    }
+
+    int fds[procs];
+    for (int p = 0; p < procs; p++)
+    {
+        int fd[2];
+        if (pipe(fd) < 0)
+        {
+            printf("error=pipe\n");
+            exit(1);
+        }
+        if (fork() == 0)
+        {
+            close(fd[0]);
+            worker(fd[1], p, pattern, op, readpct, ops, blocks, blocksize);
+            exit(0);
+        }
+        close(fd[1]);
+        fds[p] = fd[0];
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (int p = 0; p < procs; p++)
+    {
+        if (readall(fds[p], &part, sizeof(part)) < 0)
+        {
+            printf("error=worker\n");
+            exit(1);
+        }
+        close(fds[p]);
+
+        if (p == 0 || part.start < total.start)
+            total.start = part.start;
+        if (part.end > total.end)
+            total.end = part.end;
+        total.ops += part.ops;
+        total.errors += part.errors;
+        for (int b = 0; b < BUCKETS; b++)
+            total.hist[b] += part.hist[b];
+    }
+
+    for (int p = 0; p < procs; p++)
+        wait(0);
+    if (rebuilder > 0)
+        wait(0);
+    else if (scenario == DEGRADED)
+        disk_repaired_raid(FAILDISK);
+
+    uint64 us = total.end - total.start;
+    if (us == 0)
+        us = 1;
+    printf("ops=%d errors=%d usec=%l iops=%l kbps=%l p50=%l p99=%l\n",
+           total.ops, total.errors, us,
+           (uint64)total.ops * 1000000 / us,
+           (uint64)total.ops * blocksize * 1000000 / 1024 / us,
+           percentile(&total, 50), percentile(&total, 99));
+}
+
+// index of name in names, -1 if none
+int
+lookup(char* name, char** names, int n)
+{
+    for (int i = 0; i < n; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+void
+usage(void)
+{
+    printf("usage: raidbench [-t type|all] [-s normal|degraded|rebuild|all] [-p seq|rand|zipf]\n"
+           "                 [-o read|write|mix] [-r readpercent] [-n ops] [-P procs]\n");
+    exit(1);
+}
+
+int
+main(int argc, char* argv[])
+{
+    int type = -1, scenario = NORMAL, pattern = RAND, op = MIX;
+    int readpct = 50, ops = 500, procs = 4;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' || argv[i][2] != 0 || i + 1 >= argc)
+            usage();
+        char* v = argv[++i];
+        switch (argv[i-1][1])
+        {
+            case 't':
+                type = strcmp(v, "all") == 0 ? -1 : lookup(v, typenames, NELEM(typenames));
+                if (type < 0 && strcmp(v, "all") != 0)
+                    usage();
+                break;
+            case 's':
+                scenario = strcmp(v, "all") == 0 ? -1 : lookup(v, scenarionames, NELEM(scenarionames));
+                if (scenario < 0 && strcmp(v, "all") != 0)
+                    usage();
+                break;
+            case 'p':
+                if ((pattern = lookup(v, patternnames, NELEM(patternnames))) < 0)
+                    usage();
+                break;
+            case 'o':
+                if ((op = lookup(v, opnames, NELEM(opnames))) < 0)
+                    usage();
+                break;
+            case 'r':
+                readpct = atoi(v);
+                break;
+            case 'n':
+                ops = atoi(v);
+                break;
+            case 'P':
+                procs = atoi(v);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (procs < 1 || ops < 1 || readpct < 0 || readpct > 100)
+        usage();
+
+    for (int t = 0; t < NELEM(typenames); t++)
+    {
+        if (type >= 0 && t != type)
+            continue;
+        for (int s = 0; s < NELEM(scenarionames); s++)
+        {
+            if ((scenario >= 0 && s != scenario))
+                continue;
+            run(t, s, pattern, op, readpct, ops, procs);
+        }
+    }
+
+    exit(0);
+}
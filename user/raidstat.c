@@ -0,0 +1,88 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+#include "kernel/raidstat.h"
+
+// raidstat [ticks] - I/O statistics of the RAID layer, since boot or during ticks
+
+static char* events[STAT_EVENTS] = {"parity reads", "degraded reads", "cluster loads", "scrub repairs", "checksum errors"};
+
+static struct RAIDStat before, after;
+
+// latency buckets that are not empty
+void
+histogram(char* name, uint64* latency)
+{
+    uint64 total = 0;
+    for (int b = 0; b < STAT_BUCKETS; b++)
+        total += latency[b];
+    if (total == 0)
+        return;
+
+    printf("%s latency (time CSR cycles):\n", name);
+    for (int b = 0; b < STAT_BUCKETS; b++)
+    {
+        if (latency[b] == 0)
+            continue;
+        printf("  %l - %l: %l", 1L << b, (1L << (b + 1)) - 1, latency[b]);
+        // bar in percent of total, one # for every 2%
+        printf(" ");
+        for (int i = 0; i < latency[b] * 50 / total; i++)
+            printf("#");
+        printf("\n");
+    }
+}
+
+int
+main(int argc, char* argv[])
+{
+    if (stat_raid(&after) < 0)
+    {
+        printf("raidstat: stat_raid failed\n");
+        exit(1);
+    }
+
+    if (argc > 1)
+    {
+        before = after;
+        sleep(atoi(argv[1]));
+        stat_raid(&after);
+
+        // counters only - depth is current
+        uint64* a = (uint64*)&after;
+        uint64* b = (uint64*)&before;
+        for (int i = 0; i < sizeof(after) / sizeof(uint64); i++)
+            a[i] -= b[i];
+        for (int d = 0; d <= DISKS + SPARES; d++)
+            after.disk[d].depth += before.disk[d].depth;
+    }
+
+    printf("array: %l reads, %l writes, %l errors\n", after.ops[0], after.ops[1], after.errors);
+    for (int e = 0; e < STAT_EVENTS; e++)
+        printf("  %s: %l\n", events[e], after.events[e]);
+    histogram("read", after.latency[0]);
+    histogram("write", after.latency[1]);
+
+    uint64 lookups = after.bcache[0] + after.bcache[1];
+    printf("\nbuffer cache: %d buffers, %l hits, %l misses", NBUF, after.bcache[0], after.bcache[1]);
+    if (lookups)
+        printf(", %l%% hit rate", after.bcache[0] * 100 / lookups);
+    printf("\n");
+
+    printf("\ndisk  reads  writes  read KB  written KB  depth\n");
+    for (int d = 0; d <= DISKS + SPARES; d++)
+    {
+        struct DiskStat* s = &after.disk[d];
+        printf("%d  %l  %l  %l  %l  %d\n", d, s->ops[0], s->ops[1], s->bytes[0] / 1024, s->bytes[1] / 1024, (int)s->depth);
+    }
+
+    for (int d = 0; d <= DISKS + SPARES; d++)
+    {
+        char name[] = "disk ?";
+        name[5] = '0' + d;
+        histogram(name, after.disk[d].latency);
+    }
+
+    exit(0);
+}
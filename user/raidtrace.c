@@ -0,0 +1,48 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/trace.h"
+
+// raidtrace [cmd args...] - trace RAID requests of cmd (or print what was recorded so far).
+// every event is a line "T time req event cpu disk arg" - save the console and give it to tracedec.
+
+static struct TraceEvent events[256];
+
+int
+main(int argc, char* argv[])
+{
+    if (argc > 1)
+    {
+        // drop old events, start recording
+        while (trace_raid(1, events, sizeof(events) / sizeof(events[0])) > 0)
+            ;
+
+        int pid = fork();
+        if (pid < 0)
+        {
+            printf("raidtrace: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0)
+        {
+            exec(argv[1], argv + 1);
+            printf("raidtrace: exec %s failed\n", argv[1]);
+            exit(1);
+        }
+        wait(0);
+
+        trace_raid(0, events, 0);
+    }
+
+    int n;
+    while ((n = trace_raid(-1, events, sizeof(events) / sizeof(events[0]))) > 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            struct TraceEvent* e = &events[i];
+            printf("T %l %d %d %d %d %l\n", e->time, e->req, e->event, e->cpu, e->disk, e->arg);
+        }
+    }
+
+    exit(0);
+}
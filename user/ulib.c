@@ -2,6 +2,8 @@
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
 #include "user/user.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
 
 //
 // wrapper so that it's OK if main() does not call exit().
@@ -145,3 +147,15 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// nanoseconds since boot, like clocktime() but without a system call -
+// the time CSR is readable in user mode, and its frequency is in the VCLOCK page
+uint64
+nanotime(void)
+{
+  uint64 hz = ((struct vclock *)VCLOCK)->hz;
+  uint64 t;
+
+  asm volatile("csrr %0, time" : "=r" (t));
+  return t / hz * 1000000000 + t % hz * 1000000000 / hz;
+}
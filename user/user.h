@@ -22,6 +22,7 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+uint64 clocktime(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,8 +40,9 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+uint64 nanotime(void);
 
-enum RAID_TYPE {RAID0, RAID1, RAID0_1, RAID4, RAID5};
+enum RAID_TYPE {RAID0, RAID1, RAID0_1, RAID4, RAID5, RAID6, RAID5D};
 int init_raid(enum RAID_TYPE raid);
 int read_raid(int blkn, uchar* data);
 int write_raid(int blkn, uchar* data);
@@ -48,4 +50,20 @@ int disk_fail_raid(int diskn);
 int disk_repaired_raid(int diskn);
 int info_raid(uint *blkn, uint *blks, uint *diskn);
 int destroy_raid();
+enum RAID5_LAYOUT {RIGHT_SYMMETRIC, RIGHT_ASYMMETRIC, LEFT_SYMMETRIC, LEFT_ASYMMETRIC};
+int init_raid_layout(enum RAID_TYPE raid, int layout);
+int init_raid_disks(enum RAID_TYPE raid, int disks);
+int reshape_raid(int disks);
+enum IOSCHED_POLICY {IOSCHED_NOOP, IOSCHED_DEADLINE};
+int iosched_raid(int diskn, int policy);
+int poll_raid(int diskn, int on);
+enum IRQ_AFFINITY {IRQ_SUBMITTER = -3, IRQ_ANY = -2};
+int irq_raid(int diskn, int hart);
+struct RAIDStat;
+int stat_raid(struct RAIDStat* stat);
+struct TraceEvent;
+int trace_raid(int on, struct TraceEvent* events, int n);
+int scrub_raid(int rate);
+int checksum_raid(int on);
+int discard_raid(int blkn, int count);
 
@@ -43,4 +43,16 @@ entry("disk_fail_raid");
 entry("disk_repaired_raid");
 entry("info_raid");
 entry("destroy_raid");
+entry("init_raid_layout");
+entry("init_raid_disks");
+entry("reshape_raid");
+entry("iosched_raid");
+entry("poll_raid");
+entry("irq_raid");
+entry("stat_raid");
+entry("trace_raid");
+entry("clocktime");
+entry("scrub_raid");
+entry("checksum_raid");
+entry("discard_raid");
 